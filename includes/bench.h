@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "pipeline.h"
+
+/*
+*   Copies a generated file of file_size on the sd card and on nand (user partition),
+*   splitting it into 1 to 4 ranges, and prints the speed of each.
+*   Always with the native backend and without a hash, transform or dedup, as otherwise files aren't split.
+*   The output is checked to be identical to the input every time.
+*/
+void bench_split(const copy_opts_t *opts, size_t file_size);
+
+/*
+*   Copies a generated file on the sd card and on nand for every combination of
+*   chunk size (64KiB to 32MiB), slot count, lane count and backend.
+*   Each run is written as a line of csv to BENCH_CSV on the sd card.
+*/
+void bench_sweep(const copy_opts_t *opts, size_t file_size);
+
+/*
+*   Times mem_copy / mem_equal against newlib's memcpy / memcmp, over total bytes
+*   in BENCH_MEM_CHUNK sized buffers, and prints the speed of each. No files involved.
+*/
+#define BENCH_MEM_CHUNK 0x800000
+
+void bench_mem(size_t total);
+
+/*
+*   Sends count slots from one thread to another, on different cores, through a ring of BENCH_HANDOFF_SLOTS,
+*   and prints how long each took to be seen, once blocking straight away and once spinning first (see sync.h).
+*   The baseline is the same handoff through threads.h mtx_t / cnd_t, which the ring used before sync.h.
+*   The sender waits BENCH_HANDOFF_GAP_US between slots, so that the receiver has always run dry and is waiting.
+*/
+#define BENCH_HANDOFF_SLOTS  2
+#define BENCH_HANDOFF_GAP_US 20
+
+void bench_handoff(size_t count);
+
+/*
+*   Copies a generated file of file_size / BENCH_SCHED_SMALL on the sd card whilst a bulk copy of a
+*   file_size one is under way, both reading and writing the same storage through one scheduler (see scheduler.h).
+*   Prints how long the small copy took on its own, as interactive next to the bulk copy, and as normal next
+*   to a normal one, with how much the other copy got done meanwhile.
+*   The other copy has BENCH_SCHED_HEAD_START_MS to get up to speed first.
+*/
+#define BENCH_SCHED_SMALL         16
+#define BENCH_SCHED_HEAD_START_MS 500
+
+void bench_sched(const copy_opts_t *opts, size_t file_size);
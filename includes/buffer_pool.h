@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <threads.h>
+#include <switch.h>
+
+/*
+*   A fixed set of equally sized buffers carved out of a single allocation.
+*
+*   The pool is set up once, and rings lease their slots from it and give them back when done,
+*   so repeated copies never go back to the allocator, and the most memory the copies can ever
+*   use is known up front (which matters inside the applet heap).
+*
+*   Buffers are POOL_ALIGN aligned, which is what the fs service likes best.
+*
+*   A pool can be shared by copies running at the same time. A ring leases all of its buffers at once
+*   or none of them, so two copies can't each end up holding half of what the other needs,
+*   and a copy that finds the pool empty waits for buffers to come back rather than allocating more.
+*/
+#define POOL_ALIGN 0x1000
+
+typedef struct
+{
+    void *arena;
+    size_t buffer_size;
+    size_t buffer_count;
+    void **free_list;       // stack of buffers not leased.
+    size_t free_count;
+    mtx_t mtx;
+    cnd_t freed;            // signalled whenever buffers are returned.
+} buffer_pool_t;
+
+//  buffer_size is rounded up to POOL_ALIGN. Returns false on error.
+bool pool_init(buffer_pool_t *pool, size_t buffer_size, size_t buffer_count);
+void pool_exit(buffer_pool_t *pool);
+
+//  Returns NULL if every buffer is already leased.
+void *pool_lease(buffer_pool_t *pool);
+void pool_return(buffer_pool_t *pool, void *buffer);
+
+//  Leases count buffers into out, or none if there aren't that many free. Returns false if none were.
+bool pool_lease_many(buffer_pool_t *pool, void **out, size_t count);
+
+//  Waits up to timeout_ns for at least count buffers to be free, without leasing them.
+//  Returns false on timeout, or straight away if the pool will never have that many.
+bool pool_wait(buffer_pool_t *pool, size_t count, u64 timeout_ns);
+
+//  Buffers not leased right now.
+size_t pool_free_count(buffer_pool_t *pool);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+
+bool console_init(void);
+void console_exit(void);
+
+//  Thread safe console update function.
+void print_console(const char *text, ...);
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <switch.h>
+
+#include "copy_engine.h"
+#include "telemetry.h"
+
+//  How often on_progress is called.
+#define COPY_PROGRESS_INTERVAL_MS 250
+
+typedef struct copy_task copy_task_t;
+
+//  Both are called from the task's own thread, never the one that started it.
+typedef void (*copy_progress_fn)(size_t done, size_t total, u64 elapsed_ticks, void *user);
+typedef void (*copy_done_fn)(copy_task_t *task, bool ok, void *user);
+
+/*
+*   A copy that runs in the background, so that the thread that starts it can carry on
+*   (drawing, reading input) and only look in on it with poll, or stop it with cancel.
+*
+*   The task has a thread of its own which starts the engine, adds src (a file or a folder),
+*   and then waits for the lanes, waking every COPY_PROGRESS_INTERVAL_MS to report progress
+*   and take a telemetry sample when one is due.
+*/
+struct copy_task
+{
+    copy_engine_t engine;           // only look at it once the task is done.
+    copy_opts_t opts;
+    char src[FS_MAX_PATH];
+    char dst[FS_MAX_PATH];
+    copy_progress_fn on_progress;
+    copy_done_fn on_done;
+    void *user;
+    Thread thread;
+    mtx_t mtx;                      // cancel against the engine starting / stopping.
+    bool running;                   // the lanes are up, under mtx.
+    bool cancelled;                 // under mtx.
+    bool added;                     // every file in src was found.
+    bool ok;
+    u64 start_tick;
+    atomic_bool done;
+    atomic_size_t data_done;        // copies of the engine's counters, for poll.
+    atomic_size_t total_size;
+    telemetry_t telemetry;          // safe to read whilst the task is running, through telemetry.h.
+};
+
+//  Starts copying src to dst, returns NULL on error. The callbacks are optional.
+//  The opts are copied, but their pool must stay around for as long as the task.
+copy_task_t *copy_start(const char *src, const char *dst, const copy_opts_t *opts,
+    copy_progress_fn on_progress, copy_done_fn on_done, void *user);
+
+//  Returns true once the task is done, done / total are optional and may be a little behind.
+bool copy_poll(copy_task_t *task, size_t *done, size_t *total);
+
+//  Stops the copy as soon as it can. Files that weren't finished fail, the task still needs waiting on.
+void copy_cancel(copy_task_t *task);
+
+//  Blocks until the task is done, returns true if everything was copied.
+bool copy_wait(copy_task_t *task);
+
+//  Waits for the task, then frees it.
+void copy_free(copy_task_t *task);
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "job.h"
+#include "pipeline.h"
+
+#define DEFAULT_LANES 2
+#define MAX_LANES     6
+
+/*
+*   Very big files can be split into ranges, each copied by a different lane.
+*   Split off by default. When splitting, the engine starts at least split_count lanes.
+*/
+#define DEFAULT_SPLIT_COUNT     1
+#define DEFAULT_SPLIT_THRESHOLD 0x40000000
+
+/*
+*   Small files are packed into slots, many to a slot, so that a folder of thousands of them
+*   doesn't send thousands of nearly empty slots through the ring.
+*/
+#define DEFAULT_PACK_SIZE 0x10000
+
+/*
+*   With a memory budget the slots are fitted to it, rather than the budget to the slots.
+*   The chunk size is halved (down to BUDGET_MIN_CHUNK) until every lane gets at least BUDGET_MIN_SLOTS,
+*   then each lane gets as many slots as are left in the budget. Lanes are only dropped if that isn't enough.
+*   Applets have a small heap, so they get a budget unless one is given.
+*/
+#define BUDGET_MIN_CHUNK 0x10000
+#define BUDGET_MIN_SLOTS 2
+#define DEFAULT_APPLET_BUDGET 0x2000000
+
+/*
+*   The copy engine owns a queue of jobs and a pool of lanes that serve it.
+*   Jobs can be added whilst the lanes are already copying earlier ones.
+*/
+typedef struct
+{
+    copy_opts_t opts;
+    thread_t lanes[MAX_LANES];
+    size_t lane_count;
+    job_queue_t queue;
+    copy_job_t *jobs;       // every job added, newest first.
+    split_file_t *splits;   // every file that has been split.
+    size_t job_count;
+    size_t file_count;
+    size_t total_size;
+    size_t add_failed;          // files counted that couldn't be given all of their jobs.
+    size_t verified_count;
+    buffer_pool_t own_pool;     // used when the opts don't have a pool.
+    bool has_own_pool;
+    dedup_store_t store;        // when the opts have a dedup_dir.
+    commit_gate_t gate;         // when the opts commit.
+    bool out_of_buffers;        // start failed only because the pool didn't have the buffers free.
+    u64 start_tick;
+    u64 elapsed_ticks;      // set by finish.
+    atomic_bool cancelled;
+} copy_engine_t;
+
+//  Fills in the default options.
+void copy_opts_default(copy_opts_t *opts);
+
+//  The number of lanes the engine will start for these opts.
+size_t copy_engine_lane_count(const copy_opts_t *opts);
+
+//  The number of pool buffers the engine needs for these opts, of pipeline_buffer_size.
+size_t copy_engine_buffers_needed(const copy_opts_t *opts);
+
+//  The number of pool buffers each lane leases, all at once.
+size_t copy_engine_lane_buffers(const copy_opts_t *opts);
+
+//  Sets the chunk size, slot count and lane count to fit in memory_budget, if there is one.
+//  The chunk size is left alone when decompressing. Returns false if not even one lane fits.
+bool copy_engine_fit_budget(copy_opts_t *opts);
+
+//  The biggest chunk size any of the compressed files in src (a file or a folder) was compressed with,
+//  which decompressing them needs at least. 0 if there are none.
+size_t copy_engine_compressed_chunk(FileBackend backend, const char *src);
+
+//  Starts the lanes, which wait for jobs to be added. If it fails only because a shared pool
+//  is in use by other copies, out_of_buffers is set and it's worth trying again once some are returned.
+bool copy_engine_start(copy_engine_t *e, const copy_opts_t *opts);
+
+//  Adds a file, splitting it into ranges if it is big enough.
+bool copy_engine_add_file(copy_engine_t *e, const char *src, const char *dst);
+
+//  Recursively adds every file in src, creating the folders in dst as it goes.
+bool copy_engine_add_dir(copy_engine_t *e, const char *src, const char *dst);
+
+//  Total bytes of the sources read so far across all lanes. Safe to call from any thread.
+size_t copy_engine_data_read(copy_engine_t *e);
+
+//  Total bytes written so far across all lanes. Safe to call from any thread.
+size_t copy_engine_data_written(copy_engine_t *e);
+
+//  Total bytes of the sources written so far, the same as data_written unless transforming.
+size_t copy_engine_data_done(copy_engine_t *e);
+
+//  Slots filled and waiting to be written, across all lanes. Safe to call from any thread.
+size_t copy_engine_queue_depth(copy_engine_t *e);
+
+//  Total time the lanes' readers and writers have spent waiting on their rings. Safe to call from any thread.
+u64 copy_engine_stall_ticks(copy_engine_t *e);
+
+//  No more jobs will be added, waits up to timeout_ns for the lanes to finish the ones that were.
+//  Returns true once they have, finish still needs calling.
+bool copy_engine_wait(copy_engine_t *e, u64 timeout_ns);
+
+//  Stops every lane as soon as it can, jobs that don't get finished fail.
+//  Safe to call from another thread whilst the lanes are running, but not during start / finish.
+void copy_engine_cancel(copy_engine_t *e);
+
+//  Waits for every job added so far to finish and stops the lanes.
+//  With verify, each file is then read back and its hash compared.
+void copy_engine_finish(copy_engine_t *e);
+
+//  Returns the number of jobs that failed, and files that couldn't be added as jobs at all.
+size_t copy_engine_failed(const copy_engine_t *e);
+
+//  Combines the stats of every lane, call after finish.
+void copy_engine_stats(const copy_engine_t *e, stage_stats_t stats[Stage_Count]);
+
+//  Prints the summary of each stage, call after finish.
+void copy_engine_print_stats(const copy_engine_t *e);
+
+//  Frees all of the jobs, call after finish.
+void copy_engine_exit(copy_engine_t *e);
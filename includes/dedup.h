@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <threads.h>
+#include <switch.h>
+
+#include "file_io.h"
+
+/*
+*   A content addressed store, for backups that copy much the same files over and over.
+*
+*   The store is a folder holding every chunk it has ever been given, each only once:
+*       DEDUP_PACK_NAME     the chunks, back to back.
+*       DEDUP_INDEX_NAME    DEDUP_INDEX_MAGIC, then a dedup_entry_t for each chunk in the pack.
+*
+*   Files are copied in fixed size chunks (so the same data lines up the same way next time),
+*   the hash thread works out the sha256 of each, and the writer writes dst as a recipe of
+*   references to the chunks in the pack, adding to the pack only the chunks it doesn't already have.
+*   A recipe is DEDUP_RECIPE_MAGIC, then a dedup_ref_t for each chunk of the file, in order.
+*
+*   Every lane writes to the same store, so it has a lock. The index is kept in memory as a hash table.
+*   New entries are held back until DEDUP_PENDING_MAX of them (or the store is closed), then the pack is
+*   flushed before they go on the end of the index file. The pack is only ever added to, so a store that
+*   was interrupted at worst has chunks that aren't in the index, which are never reused.
+*   Should the index still point past the end of the pack, the entries from there on are dropped when it is opened.
+*/
+#define DEDUP_PACK_NAME     "blocks.pack"
+#define DEDUP_INDEX_NAME    "blocks.index"
+#define DEDUP_INDEX_MAGIC   0x58444954 // "TIDX"
+#define DEDUP_RECIPE_MAGIC  0x43455254 // "TREC"
+#define DEDUP_HASH_SIZE     SHA256_HASH_SIZE
+#define DEDUP_TABLE_MIN     0x400
+#define DEDUP_PENDING_MAX   64
+
+typedef struct
+{
+    u8 digest[DEDUP_HASH_SIZE];
+    u64 offset;         // in the pack.
+    u32 size;
+    u32 reserved;
+} dedup_entry_t;
+
+typedef struct
+{
+    u64 offset;
+    u32 size;
+    u32 reserved;
+} dedup_ref_t;
+
+typedef struct
+{
+    FileBackend backend;
+    file_t pack;
+    FILE *index;
+    dedup_entry_t *table;   // open addressing, an entry of size 0 is empty.
+    size_t table_size;      // a power of 2.
+    size_t entry_count;
+    u64 pack_size;
+    dedup_entry_t pending[DEDUP_PENDING_MAX];   // in the pack, not yet in the index file.
+    size_t pending_count;
+    mtx_t mtx;
+} dedup_store_t;
+
+//  Opens the store in dir, creating it if there isn't one. Returns false on error.
+bool dedup_open(dedup_store_t *store, FileBackend backend, const char *dir);
+void dedup_close(dedup_store_t *store);
+
+//  Finds the chunk with this digest, or adds data to the pack as it. Safe to call from any lane.
+//  added says which it was. Returns false on error.
+bool dedup_put(dedup_store_t *store, const u8 *digest, const void *data, size_t size, dedup_ref_t *ref, bool *added);
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <stdatomic.h>
+#include <switch.h>
+
+#include "tcp.h"
+
+/*
+*   Files can be accessed in two ways.
+*
+*   Stdio goes through newlib's FILE buffering and the devoptab layer before it reaches the fs service.
+*   Native skips all of that and talks to the fs service directly with fsFile* and explicit offsets,
+*   so each read / write is exactly one request of the size we asked for.
+*
+*   Either end can also be a stream rather than a file, a "tcp://" path (see tcp.h).
+*   That is picked from the path whatever the backend, and a stream has no size and can't seek.
+*/
+typedef enum
+{
+    FileBackend_Stdio,
+    FileBackend_Native,
+    FileBackend_Tcp,
+} FileBackend;
+
+typedef struct
+{
+    FileBackend backend;
+    FILE *fp;
+    FsFile file;
+    tcp_t tcp;
+    bool failed;    // tcp, a read stopped short because the connection broke rather than ended.
+    s64 offset;     // native and tcp, stdio keeps track of its own position.
+} file_t;
+
+//  True for paths that are a stream, which is read until it ends rather than for a size.
+bool file_is_stream(const char *path);
+
+//  Opens an existing file for reading. Returns false on error.
+bool file_open_read(file_t *f, FileBackend backend, const char *path);
+
+//  Creates (or truncates) a file for writing. Returns false on error.
+bool file_open_write(file_t *f, FileBackend backend, const char *path);
+
+//  Opens an existing file for writing without truncating it. Returns false on error.
+bool file_open_existing(file_t *f, FileBackend backend, const char *path);
+
+//  A stream gives up waiting on the other end once *cancelled is set, see tcp.h. Nothing for a file.
+void file_set_cancel(file_t *f, const atomic_bool *cancelled);
+
+//  Moves to an absolute offset, so that a file can be read / written in ranges.
+bool file_seek(file_t *f, s64 offset);
+
+//  The offset the next read / write is at.
+s64 file_tell(file_t *f);
+
+//  Returns the number of bytes read / written, which is less than size on error or eof.
+size_t file_read(file_t *f, void *buf, size_t size);
+size_t file_write(file_t *f, const void *buf, size_t size);
+
+//  Sets the size of a file opened for writing.
+//  Doing this once up front stops the filesystem from extending the file on every write.
+bool file_set_size(file_t *f, s64 size);
+
+//  Makes sure everything written so far is on the storage, not just in a cache.
+bool file_flush(file_t *f);
+
+//  Commits the filesystem that path is on, which save data needs for anything written to be kept.
+bool file_commit(const char *path);
+
+void file_close(file_t *f);
+
+//  The size of an open file. Returns 0 on error.
+size_t file_get_size(file_t *f);
+
+//  Gets the file size without reading any of it. Returns 0 on error.
+size_t get_file_size(FileBackend backend, const char *path);
+
+/*
+*   Lists a folder, along with the size of each file.
+*   Native gets the sizes from fsDirRead itself, a batch of entries per call,
+*   so a folder of thousands of files doesn't need every file opened just to size it.
+*   Stdio has to stat each file.
+*/
+#define DIR_READ_BATCH 32
+
+typedef struct
+{
+    char name[FS_MAX_PATH];
+    bool is_dir;
+    size_t size;
+} dir_entry_t;
+
+typedef struct
+{
+    FileBackend backend;
+    const char *path;
+    DIR *dir;
+    FsDir fs_dir;
+    FsDirectoryEntry *entries;  // DIR_READ_BATCH of them, on the heap as folders are walked recursively.
+    s64 count;
+    s64 next;
+} dir_t;
+
+bool dir_open(dir_t *d, FileBackend backend, const char *path);
+
+//  Returns false once there are no more entries. "." and ".." are skipped.
+bool dir_read(dir_t *d, dir_entry_t *entry);
+
+void dir_close(dir_t *d);
+
+const char *file_backend_name(FileBackend backend);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <switch.h>
+
+#include "file_io.h"
+
+/*
+*   Checksums that can be worked out whilst copying.
+*   Crc32 uses the armv8 crc instructions (+crc in ARCH), and is the same crc32 as zlib / zip.
+*   Sha256 uses libnx, which uses the armv8 crypto instructions.
+*/
+typedef enum
+{
+    HashType_None,
+    HashType_Crc32,
+    HashType_Sha256,
+} HashType;
+
+#define HASH_MAX_SIZE SHA256_HASH_SIZE
+
+typedef struct
+{
+    HashType type;
+    u32 crc;
+    Sha256Context sha;
+} hash_ctx_t;
+
+void hash_init(hash_ctx_t *ctx, HashType type);
+void hash_update(hash_ctx_t *ctx, const void *data, size_t size);
+
+//  Writes hash_size(type) bytes to out.
+void hash_final(hash_ctx_t *ctx, u8 *out);
+
+size_t hash_size(HashType type);
+const char *hash_name(HashType type);
+
+//  Writes the digest as hex, out must be at least hash_size(type) * 2 + 1.
+void hash_to_hex(HashType type, const u8 *digest, char *out);
+
+//  Hashes size bytes of a file from offset, using buf (of buf_size) to read into.
+//  Returns false on error.
+bool hash_file(FileBackend backend, const char *path, s64 offset, size_t size, HashType type,
+    void *buf, size_t buf_size, u8 *out);
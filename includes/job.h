@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <switch.h>
+
+#include "file_io.h"
+#include "hash.h"
+
+/*
+*   The ranges of a split file are written by different lanes at the same time,
+*   but the fs only lets a file be open for writing once. So the engine opens dst once
+*   (and sizes it), and every range writes through that one handle at its own offset.
+*   Native only, as stdio can't be shared like that without every write taking turns.
+*/
+typedef struct split_file
+{
+    file_t file;
+    atomic_size_t ranges_left;  // whoever finishes the last range closes the file.
+    struct split_file *next;    // next one owned by the engine.
+} split_file_t;
+
+/*
+*   A single file (or range of a file) to be copied from src to dst.
+*   Big files can be split into several range jobs which are copied in parallel,
+*   in which case dst is created up front and each job writes its range in place.
+*/
+typedef struct copy_job
+{
+    char src[FS_MAX_PATH];
+    char dst[FS_MAX_PATH];
+    s64 offset;                 // where the range starts in both files.
+    size_t size;                // size of the range, the whole file unless split.
+    bool create;                // create dst, false if it already exists and is the right size.
+    bool journal;               // keep a journal whilst writing, see journal.h.
+    bool pack;                  // small enough to share a slot with other small files.
+    bool stream;                // src is a stream, size is unknown (0) and it is read until it ends.
+    split_file_t *split;        // the file this is a range of, NULL for a whole file.
+    atomic_size_t data_written;
+    atomic_int result;          // 0 on success, set by whichever thread fails and read by the others.
+    bool finished;              // the writer has seen the last slot, false if it never got that far.
+    hash_ctx_t hash;            // only touched by the hash thread.
+    u8 digest[HASH_MAX_SIZE];   // hash of the source, once the job is done.
+    struct copy_job *next;      // next job in the queue.
+    struct copy_job *list_next; // next job owned by the engine.
+} copy_job_t;
+
+/*
+*   A fifo of jobs shared by all of the read threads.
+*   Popping blocks until there is a job, or the queue is closed and empty.
+*/
+typedef struct
+{
+    copy_job_t *head;
+    copy_job_t *tail;
+    bool closed;
+    mtx_t mtx;
+    cnd_t can_pop;
+} job_queue_t;
+
+bool job_queue_init(job_queue_t *q);
+void job_queue_exit(job_queue_t *q);
+
+void job_queue_push(job_queue_t *q, copy_job_t *job);
+
+//  Returns NULL once the queue is closed and there are no more jobs.
+copy_job_t *job_queue_pop(job_queue_t *q);
+
+//  Never blocks, pops the next job only if it can be packed and is no bigger than max_size.
+copy_job_t *job_queue_pop_packable(job_queue_t *q, size_t max_size);
+
+//  No more jobs will be pushed, wakes up everyone waiting in pop.
+void job_queue_close(job_queue_t *q);
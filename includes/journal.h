@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <switch.h>
+
+#include "file_io.h"
+
+/*
+*   A journal lets a copy that was interrupted carry on from where it got to.
+*
+*   Every JOURNAL_INTERVAL bytes the writer flushes dst and then writes dst + JOURNAL_EXT,
+*   which says how much of dst is known to be on the storage and has a crc32 of the last
+*   (up to JOURNAL_TAIL_SIZE) bytes before that point. It is deleted once the file is done.
+*
+*   When a file is added and has a journal, the tail is checked against both src and dst.
+*   If both still match, only the rest of the file is copied, into dst as it is.
+*/
+#define JOURNAL_EXT       ".journal"
+#define JOURNAL_INTERVAL  0x4000000
+#define JOURNAL_TAIL_SIZE 0x100000
+#define JOURNAL_MAGIC     0x4E524A54 // "TJRN"
+
+typedef struct
+{
+    u32 magic;
+    u32 tail_crc;
+    u64 file_size;      // size of src, a journal for a different size is ignored.
+    u64 offset;         // dst is good up to here.
+    u64 tail_size;      // bytes before offset covered by tail_crc.
+} journal_t;
+
+//  Writes the journal of dst. Returns false on error.
+bool journal_save(const char *dst, const journal_t *journal);
+
+//  Deletes the journal of dst, if it has one.
+void journal_remove(const char *dst);
+
+//  Returns the offset a copy of src to dst can resume from, 0 to copy all of it.
+size_t journal_resume_offset(FileBackend backend, const char *src, const char *dst, size_t src_size);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+*   Bulk copy / compare of big buffers, NEON 64 bytes at a time.
+*
+*   newlib's memcpy / memcmp are tuned for the small sizes most code passes them,
+*   these are for slot sized buffers, which are POOL_ALIGN aligned and a multiple of 64 bytes
+*   for all but the last chunk of a file. Anything can be passed, the ends are done a byte at a time.
+*   bench_mem compares them with newlib.
+*/
+void mem_copy(void *dst, const void *src, size_t size);
+
+//  Unlike memcmp, only says whether they are the same, so it can or a whole block before looking.
+bool mem_equal(const void *a, const void *b, size_t size);
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <switch.h>
+
+#include "buffer_pool.h"
+#include "dedup.h"
+#include "file_io.h"
+#include "hash.h"
+#include "job.h"
+#include "ring.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "transform.h"
+#include "tuner.h"
+
+/*
+*   Cores an application can use are 0 to 2.
+*   CORE_AUTO spreads the lanes over all of them, keeping a lane's read and write threads apart.
+*   The transform threads of a lane are spread from their core onwards.
+*   CORE_DEFAULT lets libnx use the default core for the process.
+*
+*   Priorities go from 0 (highest) to 0x3F (lowest).
+*   PRIO_DEFAULT uses the priority of the thread that starts the copy.
+*/
+#define CORE_COUNT   3
+#define CORE_AUTO    -1
+#define CORE_DEFAULT -2
+#define PRIO_DEFAULT -1
+
+/*
+*   When the writer makes sure what it has written is on the storage.
+*   Flushing only at the end is the fastest, but leaves a file's whole written size to go out on close.
+*   An interval spreads that out, flushing after each flush_interval bytes (and at the end).
+*   Each chunk is the safest, nothing written is ever more than a chunk behind.
+*
+*   Save data only keeps what is written once its filesystem is committed, so with commit
+*   every file is committed too. The fs won't commit whilst any file on it is open for writing,
+*   so that is once the file is closed, see commit_gate_t.
+*/
+typedef enum
+{
+    FlushPolicy_End,
+    FlushPolicy_Interval,
+    FlushPolicy_Chunk,
+} FlushPolicy;
+
+#define DEFAULT_FLUSH_INTERVAL 0x2000000
+
+/*
+*   Every lane writes at the same time, so one lane closing its file doesn't mean nothing is open.
+*   Writers hold the gate open for as long as they have a file open for writing, and a commit
+*   asked for whilst another one still does is left for whoever closes last. The engine has one.
+*   Each filesystem asked for is committed, up to COMMIT_GATE_MAX_FS of them waiting at once.
+*/
+#define COMMIT_GATE_MAX_FS 4
+
+typedef struct
+{
+    Mutex mtx;
+    size_t open;                // files open for writing.
+    size_t pending;             // filesystems waiting for them to close.
+    char paths[COMMIT_GATE_MAX_FS][FS_MAX_PATH];    // a path on each of them.
+} commit_gate_t;
+
+void commit_gate_init(commit_gate_t *g);
+
+//  A file is about to be opened for writing. Does nothing without a gate, as does close.
+void commit_gate_open(commit_gate_t *g);
+
+//  The file is closed, and if path isn't NULL the filesystem it is on should be committed.
+//  Commits now if nothing else is open. Returns false if a commit failed, or there were too many to wait.
+bool commit_gate_close(commit_gate_t *g, const char *path);
+
+typedef struct
+{
+    FileBackend backend;
+    bool preallocate;       // set the output file size before the first write.
+    size_t sparse_block;    // skip zero blocks of this size in preallocated files, 0 to write everything.
+    size_t chunk_size;      // size of each slot, and of each read / write unless adaptive.
+    bool adaptive;          // tune the size of each read / write at runtime, up to chunk_size.
+    size_t slot_count;      // slots in each lane's ring.
+    size_t lane_count;      // number of read / write thread pairs.
+    size_t split_count;     // number of ranges to split big files into, 1 to never split.
+    size_t split_threshold; // files smaller than this are never split.
+    int read_core;
+    int write_core;
+    int hash_core;
+    int transform_core;
+    int read_prio;
+    int write_prio;
+    HashType hash;          // hash every file as it goes past, HashType_None to not.
+    bool verify;            // read back every file once written and compare the hash.
+    bool resume;            // journal whole files whilst writing them, and resume from a journal.
+    TransformType transform;    // compress / decompress every file, TransformType_None to copy.
+    int transform_level;
+    size_t transform_workers;   // transform threads in each lane, they take turns with the slots.
+    size_t read_ahead;          // fetch threads in each lane doing the reads, 0 for the reader to read.
+    buffer_pool_t *pool;    // where slots come from, NULL for the engine to make its own.
+    size_t memory_budget;   // most bytes of slots, the chunk size and slot count are fitted to it. 0 for no limit.
+    size_t pack_size;       // files up to this size are packed together into slots, 0 to not.
+    FlushPolicy flush;
+    size_t flush_interval;  // bytes written between flushes, for FlushPolicy_Interval.
+    bool commit;            // commit dst's filesystem, for save data.
+    commit_gate_t *commit_gate; // shared by the writers when committing, the engine sets it.
+    const char *dedup_dir;  // write each file as a recipe of chunks in the store in this folder, NULL to copy.
+    dedup_store_t *dedup;   // the store, the engine opens it.
+    sched_t *sched;         // shared with other copies running at the same time, NULL if there are none.
+    CopyClass copy_class;   // this copy's share of sched.
+    bool keep_going;        // carry on with the other files when one fails, rather than stopping the copy.
+    void (*on_error)(void *user);   // called from whichever thread fails a job, the engine sets this.
+    void *on_error_user;
+} copy_opts_t;
+
+//  The jobs a thread in a lane can do. Only read and write are always there.
+typedef enum
+{
+    Stage_Read,
+    Stage_Fetch,
+    Stage_Hash,
+    Stage_Transform,
+    Stage_Write,
+    Stage_Count,
+} Stage;
+
+/*
+*   Read ahead splits reading in two. The read thread only plans each slot (which job, where, how much)
+*   and fetch threads, taking turns with the slots, do the reads. As planning never blocks on the storage,
+*   the reader stays as far ahead as the ring allows, and up to read_ahead reads are in flight at once.
+*   Each fetch thread has its own handle to the file, native only as it needs explicit offsets.
+*/
+#define FETCH_MAX_THREADS 4
+
+/*
+*   A lane is one read thread and one write thread joined by a ring,
+*   plus fetch, hash and / or transform threads in between them.
+*   The read thread pops jobs from the shared queue and streams them through the ring,
+*   so the threads are created once and then reused for every file, rather than per file.
+*
+*   There is a thread for each ring stage, and every stage but the transform is a single thread.
+*/
+typedef struct thread_s thread_t;
+
+//  What each thread is given, so that the transform threads know which of them they are.
+typedef struct
+{
+    thread_t *lane;
+    size_t stage;
+} worker_t;
+
+struct thread_s
+{
+    ring_t ring;
+    job_queue_t *queue;
+    copy_opts_t opts;
+    size_t ring_stage[Stage_Count];     // first stage of the ring each one is.
+    size_t stage_threads[Stage_Count];  // how many ring stages (threads) each one has.
+    bool has_stage[Stage_Count];
+    size_t eos_count;                   // end of stream slots the reader sends, so every thread of a group gets one.
+    atomic_size_t data_read;            // bytes of the sources read so far, for telemetry.
+    atomic_size_t data_written;
+    atomic_size_t data_done;            // bytes of the source that have been written, for progress.
+    chunk_tuner_t tuner;                // only touched by the read thread.
+    stage_stats_t stats[RING_MAX_STAGES];   // by ring stage, each only touched by the thread of that stage.
+    worker_t workers[RING_MAX_STAGES];
+    Thread threads[RING_MAX_STAGES];
+};
+
+//  Starts the threads of a lane, they run until the queue is closed and empty.
+//  The opts must have a pool with buffers of at least chunk_size.
+bool pipeline_start(thread_t *t, job_queue_t *queue, const copy_opts_t *opts, const int cores[Stage_Count]);
+
+//  Waits for every thread to exit and frees the ring.
+void pipeline_join(thread_t *t);
+
+//  Waits up to timeout_ns for every thread to exit, returns true if they all have.
+//  The lane still needs joining after.
+bool pipeline_wait(thread_t *t, u64 timeout_ns);
+
+//  Stops every thread of the lane at the next slot, even if it is waiting.
+//  Any job in the middle of being copied fails. Safe to call from any thread whilst the lane is running.
+void pipeline_cancel(thread_t *t);
+
+//  Adds the stats of every thread of a stage to out.
+void pipeline_stage_stats(const thread_t *t, Stage stage, stage_stats_t *out);
+
+//  Resolves PRIO_DEFAULT to the priority of the calling thread.
+int pipeline_resolve_prio(int prio);
+
+//  The pool buffer size needed for a chunk_size with these opts, bigger than chunk_size when compressing.
+size_t pipeline_buffer_size(const copy_opts_t *opts);
+
+const char *stage_name(Stage stage);
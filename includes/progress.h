@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <switch.h>
+
+#include "telemetry.h"
+
+/*
+*   Redraws a single progress line, for the on_progress of copy_start.
+*   It gets called from the copy's own thread every COPY_PROGRESS_INTERVAL_MS,
+*   so the read / write threads never wait on the console.
+*/
+void progress_print(size_t done, size_t total, u64 elapsed_ticks, void *user);
+
+/*
+*   A graph of the last PROGRESS_GRAPH_WIDTH telemetry samples, one column a second,
+*   with a line of how far the copy has got and the newest sample under it.
+*   Each column is # up to the write speed, and : above it up to the read speed if reading was faster.
+*
+*   redraw moves back up over the last graph and draws over it, so it stays in one place.
+*   Safe to call from any thread whilst the samples are being taken.
+*/
+#define PROGRESS_GRAPH_WIDTH  64
+#define PROGRESS_GRAPH_HEIGHT 10
+
+void progress_graph(telemetry_t *tel, size_t done, size_t total, bool redraw);
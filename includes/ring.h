@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <switch.h>
+
+#include "buffer_pool.h"
+#include "job.h"
+#include "stats.h"
+#include "sync.h"
+
+/*
+*   Defined the default buffer size, which is 8MiB.
+*   The size used by a copy can be anything up to MAX_BUFSIZE, see copy_opts_t.
+*
+*   Rather than a single shared buffer, we have a ring of buffers (slots).
+*   The read thread fills the slot at head, the write thread empties the slot at tail.
+*   With more than one slot, the read thread can get a few chunks ahead of the write thread,
+*   so a single slow write no longer stalls the reader.
+*
+*   The slot count can be anything from 1 to MAX_SLOTS.
+*/
+#define BUFSIZE       0x800000
+#define MAX_BUFSIZE   0x2000000
+#define DEFAULT_SLOTS 4
+#define MAX_SLOTS     8
+
+//  The most files that can be packed into one slot, see pack_entry_t.
+#define PACK_MAX_ENTRIES 64
+
+//  One small file packed into a slot, at offset in the slot's data.
+typedef struct
+{
+    copy_job_t *job;
+    size_t offset;
+    size_t size;
+    bool error;             // the read was short, don't write it.
+} pack_entry_t;
+
+/*
+*   A slot is a buffer plus a description of what is in it.
+*   Slots from many jobs flow through the same ring, so each one says which job
+*   it belongs to and whether it is the first / last chunk of that job.
+*
+*   eof marks the end of the stream (and has no job). error means the data is bad,
+*   such as a short read, so no stage after the one that set it does anything with it.
+*   Either way it is just a flag on a slot that is going past anyway, it costs no extra wakeups.
+*
+*   A packed slot (pack_count > 0) has no job, it is a number of whole small files back to back,
+*   each described by an entry of pack.
+*/
+typedef struct
+{
+    void *data;
+    size_t size;
+    copy_job_t *job;
+    bool first;
+    bool last;
+    bool eof;
+    bool error;
+    size_t chunk_size;      // size the reader asked for, size is less for the last chunk.
+    size_t src_size;        // bytes of the source in this slot, differs from size once transformed.
+    u64 write_ticks;        // set by the writer, so the reader can see how long it took.
+    void *spare;            // a second buffer for stages that can't work in place, they swap it with data.
+    bool fetch;             // read ahead, the reader only planned this slot, a fetch thread reads size bytes into it.
+    s64 fetch_offset;
+    u64 read_ticks;         // set by the fetch thread, so the reader can tune with it.
+    u8 digest[SHA256_HASH_SIZE];    // of this chunk, set by the hash thread when deduplicating.
+    size_t pack_count;
+    pack_entry_t pack[PACK_MAX_ENTRIES];
+} slot_t;
+
+/*
+*   There is only ever one reader and one writer, so the ring is lock free.
+*   head and tail are counters that only ever go up, and only one thread writes to each.
+*   The slot index is the counter % slot_count, and head - tail is the number of filled slots.
+*
+*   Optionally there are stages in the middle (such as hashing), which see every slot
+*   after the reader and before the writer. Each stage has its own counter, pos[0] is head
+*   and pos[stage_count - 1] is tail, and a stage can only ever be at or behind the one before it.
+*   So each counter still has just one writer, and each stage only ever waits on the one before.
+*
+*   Stages come in groups. Most groups are one stage, but a group of n stages runs in parallel,
+*   the stage at index i of the group only takes slots where slot % n == i (striping).
+*   Each counter is the next slot that stage will take, so a counter in a group of n goes up by n.
+*   Whoever comes after the group reads slot s from the counter of stage s % n of that group,
+*   so the slots still come out of the group in order, however long each one took.
+*   The reader and writer are always a group of their own.
+*
+*   A thread only waits when the ring is really full (reader) or really empty (everyone else).
+*   It spins for a little while first (see sync.h), and before blocking it sets its waiting flag,
+*   and the other side only takes the mutex to signal when it sees that flag set.
+*   So in the normal case, no locks at all.
+*
+*   Cancelling wakes every stage, whether it is waiting or not, and from then on
+*   acquire returns NULL so that each thread can just stop where it is.
+*/
+#define RING_MAX_STAGES 12
+#define RING_MAX_GROUPS 5
+
+typedef struct
+{
+    slot_t slots[MAX_SLOTS];
+    size_t slot_count;
+    size_t stage_count;
+    size_t group_count;
+    size_t group_first[RING_MAX_GROUPS];        // first stage of each group.
+    size_t group_size[RING_MAX_GROUPS];
+    size_t group_of[RING_MAX_STAGES];
+    atomic_size_t pos[RING_MAX_STAGES];         // next slot each stage will take.
+    atomic_bool waiting[RING_MAX_STAGES];
+    sync_spin_t spin[RING_MAX_STAGES];          // only touched by the stage's own thread.
+    CondVar can_run[RING_MAX_STAGES];
+    Mutex mtx;
+    buffer_pool_t *pool;                        // where the slot buffers were leased from.
+    bool has_spare;                             // each slot has a second buffer, see slot_t.
+    atomic_bool cancelled;
+    stage_stats_t *stats[RING_MAX_STAGES];      // optional, wait and lock times of each stage.
+    atomic_size_t stall_ticks;                  // time the reader and writer have spent waiting, for telemetry.
+    bool lease_failed;                          // ring_init failed as the pool didn't have enough buffers free.
+} ring_t;
+
+//  Leases a buffer for each slot from the pool, 2 per slot with spare.
+//  group_sizes has the number of stages in each group, including the reader and writer.
+//  Returns false on error, with lease_failed set if that was the pool.
+bool ring_init(ring_t *r, size_t slot_count, const size_t *group_sizes, size_t group_count,
+    buffer_pool_t *pool, bool spare);
+
+//  Returns the buffers to the pool.
+void ring_exit(ring_t *r);
+
+//  Spinning before blocking is on by ring_init. Only call before the ring is in use.
+void ring_set_spin(ring_t *r, bool enabled);
+
+//  Any stage. acquire waits for the next slot for that stage, release hands it on to the next.
+//  acquire returns NULL once the ring is cancelled.
+slot_t *ring_acquire(ring_t *r, size_t stage);
+void ring_release(ring_t *r, size_t stage);
+
+//  Safe to call from any thread, wakes up every stage.
+void ring_cancel(ring_t *r);
+
+//  The number of filled slots, somewhere between the reader and the writer. Safe to call from any thread.
+size_t ring_depth(ring_t *r);
+
+//  Reader side. claim waits for an empty slot, push hands it over.
+slot_t *ring_claim(ring_t *r);
+void ring_push(ring_t *r);
+
+//  Writer side. peek waits for a filled slot, pop hands it back to the reader.
+slot_t *ring_peek(ring_t *r);
+void ring_pop(ring_t *r);
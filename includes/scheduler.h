@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <switch.h>
+
+#include "ring.h"
+
+/*
+*   Shares the storage between copies running at the same time, so that a big background copy
+*   doesn't starve a small one the user is waiting on.
+*
+*   Each copy has a class, and each class a weight. Read and write threads ask for a turn before
+*   every chunk, and then pay for the time the chunk took, at ticks / weight. A thread is held back whilst
+*   a class that has paid less wants a turn too, so with weights of 16 and 1 an interactive copy gets 16 times
+*   the storage time of a bulk one, and a bulk copy gets the storage to itself once nothing else wants it.
+*   Turns are only taken between chunks, so an interactive copy waits at most one chunk of each other thread.
+*
+*   A class only wants a turn from asking for one until it has paid for it, and for SCHED_GRACE_NS after,
+*   so not whilst its reader is waiting on its own full ring, or its writer on an empty one.
+*
+*   The slots are shared by weight too. A reader about to fill a slot is also held back whilst its class
+*   already has its share of every lane's slots filled, so a bulk copy can't have its rings full of data
+*   waiting to be written whilst an interactive copy wants the storage.
+*
+*   A class that had no jobs on starts from the least paid class with jobs, rather than from where it left off,
+*   so that being idle isn't saved up as a burst that holds everyone else back.
+*   SCHED_QUANTUM_NS of slack lets a class keep going for a while, rather than swapping on every chunk.
+*/
+typedef enum
+{
+    CopyClass_Interactive,
+    CopyClass_Normal,
+    CopyClass_Bulk,
+    CopyClass_Count,
+} CopyClass;
+
+#define SCHED_WEIGHT_INTERACTIVE 16
+#define SCHED_WEIGHT_NORMAL      4
+#define SCHED_WEIGHT_BULK        1
+#define SCHED_QUANTUM_NS         20000000ULL
+#define SCHED_GRACE_NS           2000000ULL
+#define SCHED_POLL_NS            SCHED_GRACE_NS     // nothing says when a grace runs out, so look again as often.
+#define SCHED_MAX_RINGS          32
+
+typedef struct
+{
+    u32 weight[CopyClass_Count];
+    size_t jobs[CopyClass_Count];       // readers of each class in the middle of a job.
+    size_t active[CopyClass_Count];     // threads of each class waiting for a turn or in the middle of one.
+    u64 paid[CopyClass_Count];          // ticks / weight used by each class.
+    u64 last_turn[CopyClass_Count];     // when each class last finished a turn.
+    u64 quantum;                        // SCHED_QUANTUM_NS in ticks.
+    u64 grace;                          // SCHED_GRACE_NS in ticks.
+    ring_t *rings[SCHED_MAX_RINGS];     // of every lane running, for the slots each class has filled.
+    CopyClass ring_class[SCHED_MAX_RINGS];
+    size_t ring_count;
+    mtx_t mtx;
+    cnd_t can_run;
+} sched_t;
+
+bool sched_init(sched_t *s);
+void sched_exit(sched_t *s);
+
+//  A lane of cls has started / is about to free its ring. Past SCHED_MAX_RINGS the ring isn't shared out.
+void sched_add_ring(sched_t *s, CopyClass cls, ring_t *ring);
+void sched_remove_ring(sched_t *s, ring_t *ring);
+
+//  A reader of cls has started / finished a job.
+void sched_join(sched_t *s, CopyClass cls);
+void sched_leave(sched_t *s, CopyClass cls);
+
+//  Waits for a thread of cls to have a turn, fill if it is about to read into a slot.
+//  Every wait must be paid for with sched_charge, even if nothing was done with the turn.
+//  Gives up waiting once cancelled is set, which is checked every SCHED_POLL_NS.
+//  Returns the ticks spent waiting.
+u64 sched_wait(sched_t *s, CopyClass cls, bool fill, const atomic_bool *cancelled);
+
+//  Ends a turn of cls, which took ticks.
+void sched_charge(sched_t *s, CopyClass cls, u64 ticks);
+
+const char *copy_class_name(CopyClass cls);
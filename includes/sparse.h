@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <switch.h>
+
+#include "file_io.h"
+
+/*
+*   Disk images are often mostly zeros, and a freshly created file that has been sized up front
+*   already reads back as zeros, so there's no need to write them.
+*
+*   Each chunk is checked a block at a time, runs of blocks with any data in them go out as one write,
+*   and runs of zero blocks are seeked over. Blocks are between SPARSE_MIN_BLOCK and SPARSE_MAX_BLOCK,
+*   a power of 2. Smaller blocks skip more, bigger ones mean fewer, bigger writes.
+*
+*   Only safe for a file the writer created and preallocated itself, anything else may have old data there.
+*/
+#define SPARSE_MIN_BLOCK 0x1000
+#define SPARSE_MAX_BLOCK 0x10000
+
+//  True for a block size sparse_write can use.
+bool sparse_block_valid(size_t block);
+
+//  True if every byte is 0. NEON, 64 bytes at a time.
+bool sparse_is_zero(const void *data, size_t size);
+
+//  Writes data to f at its current offset, seeking over zero blocks.
+//  Returns the bytes written or skipped, which is less than size on error. skipped is optional.
+size_t sparse_write(file_t *f, const void *data, size_t size, size_t block, size_t *skipped);
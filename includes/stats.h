@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <switch.h>
+
+/*
+*   Timings for each stage of a lane, taken with armGetSystemTick.
+*   Every stage_stats_t is only ever written by the one thread that owns it,
+*   so no atomics, and they are only read once the threads have exited.
+*
+*   The histograms are log2 buckets of microseconds.
+*   Bucket 0 is under 1us, bucket i is [2^(i-1), 2^i) us, the last bucket is everything above.
+*/
+#define STATS_BUCKETS 24
+
+typedef enum
+{
+    StatTimer_Io,       // inside file_read / file_write.
+    StatTimer_Wait,     // asleep on a full / empty ring.
+    StatTimer_Lock,     // holding the ring mutex.
+    StatTimer_Count,
+} StatTimer;
+
+typedef struct
+{
+    u64 count;
+    u64 ticks;
+    u64 max_ticks;
+    u64 buckets[STATS_BUCKETS];
+} stat_timer_t;
+
+typedef struct
+{
+    stat_timer_t timers[StatTimer_Count];
+    u64 bytes;
+    u64 skipped;    // bytes the writer didn't need to write, zeros (see sparse.h) or chunks already stored (see dedup.h).
+} stage_stats_t;
+
+//  Records a single duration.
+void stats_add(stat_timer_t *timer, u64 ticks);
+
+//  Adds everything in src to dst, to combine the lanes.
+void stats_merge(stage_stats_t *dst, const stage_stats_t *src);
+
+//  Prints a summary of a stage. elapsed_ticks is the wall time of the whole copy.
+void stats_print(const char *name, const stage_stats_t *stats, u64 elapsed_ticks);
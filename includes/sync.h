@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <switch.h>
+
+/*
+*   Waiting for another thread of a lane, with libnx's Mutex / CondVar rather than going through threads.h.
+*
+*   When chunks are small a handoff comes round in microseconds, which is less than it takes
+*   to go to sleep in the kernel and be woken again. So a waiter first spins for a little while,
+*   and only blocks if the other side still hasn't got there.
+*
+*   How long to spin adapts to each waiter. A spin that works doubles it (up to SYNC_SPIN_MAX_TICKS),
+*   a spin that doesn't halves it (down to SYNC_SPIN_MIN_TICKS), so a waiter that always ends up
+*   blocking, such as a reader waiting on a slow sd card, soon stops burning a core on it.
+*   Ticks are of armGetSystemTick, 19.2MHz.
+*/
+#define SYNC_SPIN_MIN_TICKS 8
+#define SYNC_SPIN_MAX_TICKS 384
+#define SYNC_SPIN_DEFAULT_TICKS 96
+
+typedef struct
+{
+    u64 ticks;          // how long the next spin may take, 0 to always block straight away.
+    u64 spun;           // spins that worked / didn't, for the stats.
+    u64 missed;
+} sync_spin_t;
+
+void sync_spin_init(sync_spin_t *spin, bool enabled);
+
+//  Spins until counter reaches need or cancelled is set, for as long as the spin allows.
+//  Returns true if it got there, false if it is time to block.
+bool sync_spin_until(sync_spin_t *spin, const atomic_size_t *counter, size_t need, const atomic_bool *cancelled);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+*   A TCP connection as one end of a copy, so a file can be streamed straight off the console.
+*   "tcp://host:port" connects to host, "tcp://:port" waits for something to connect to us.
+*   The other end is anything that sends / receives a raw stream, e.g. nc -l 5000 > dump.bin
+*
+*   Waiting for the other end (to connect, to send, or to take what we send) can take for ever,
+*   so every wait polls, looking at cancelled every TCP_POLL_MS. That way cancelling the copy
+*   doesn't leave a thread stuck in the socket. A listener only accepts its connection on the
+*   first read / write, so that waiting for it can be cancelled too.
+*
+*   Needs socketInitialize first, main does that when either path is a tcp one.
+*/
+#define TCP_PREFIX  "tcp://"
+#define TCP_POLL_MS 100
+
+typedef struct
+{
+    int sock;                       // -1 until there is a connection.
+    int listener;                   // waiting for a connection on this, -1 once there is one.
+    const atomic_bool *cancelled;   // optional, every wait gives up once it is set.
+} tcp_t;
+
+bool tcp_is_path(const char *path);
+
+//  Connects, or starts listening. Returns false on error.
+bool tcp_open(tcp_t *t, const char *path);
+
+//  Both keep going until size, returning less only at the end of the stream, on error or once cancelled.
+//  A read that stops short sets failed unless the stream really ended, so a dropped connection isn't taken for the end.
+size_t tcp_read(tcp_t *t, void *buf, size_t size, bool *failed);
+size_t tcp_write(tcp_t *t, const void *buf, size_t size);
+
+void tcp_close(tcp_t *t);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <switch.h>
+
+/*
+*   A sample of a copy every TELEMETRY_INTERVAL_MS, for watching a long copy as it goes
+*   (see progress_graph) and for looking back at it afterwards (see telemetry_export).
+*   A slow sd card shows up as writes that never get up to speed with the ring always full,
+*   throttling as a speed that drops off part way through.
+*
+*   The samples are kept in a ring of TELEMETRY_MAX_SAMPLES, so once it is full each new sample
+*   replaces the oldest, and a copy longer than that only has its last hour.
+*
+*   Samples are taken by whoever is watching the copy (the copy task's thread), from running totals
+*   of the engine's counters, so the read / write threads never do anything more for it.
+*   The lock is only so that another thread can draw / export whilst samples are still being taken.
+*/
+#define TELEMETRY_INTERVAL_MS 1000
+#define TELEMETRY_MAX_SAMPLES 3600
+
+//  Running totals since the copy started.
+typedef struct
+{
+    u64 bytes_read;
+    u64 bytes_written;
+    u64 stall_ticks;        // time the readers / writers have spent waiting on a full / empty ring.
+    size_t queue_depth;     // right now, not a total.
+} telemetry_counters_t;
+
+typedef struct
+{
+    u64 tick;               // end of the sample, ticks since the copy started.
+    u64 ticks;              // length of the sample, the last one can be short.
+    u64 bytes_read;         // during the sample.
+    u64 bytes_written;
+    u64 stall_ticks;        // summed over the lanes, so can be more than ticks.
+    size_t queue_depth;     // filled slots across all lanes, at the end of the sample.
+} telemetry_sample_t;
+
+typedef struct
+{
+    telemetry_sample_t samples[TELEMETRY_MAX_SAMPLES];
+    size_t count;           // samples ever taken, the newest is at (count - 1) % TELEMETRY_MAX_SAMPLES.
+    u64 start_tick;
+    u64 last_tick;
+    telemetry_counters_t last;
+    Mutex mtx;
+} telemetry_t;
+
+void telemetry_init(telemetry_t *tel, u64 start_tick);
+
+//  Takes a sample if TELEMETRY_INTERVAL_MS has gone by since the last one, or whatever there is if force.
+//  Returns true if it took one. Only ever call from the one thread.
+bool telemetry_update(telemetry_t *tel, const telemetry_counters_t *now, bool force);
+
+//  Samples ever taken, which goes up by one with each new sample.
+size_t telemetry_count(telemetry_t *tel);
+
+//  Copies the newest samples (up to max of them) into out, oldest first. Returns how many.
+size_t telemetry_latest(telemetry_t *tel, telemetry_sample_t *out, size_t max);
+
+//  Writes every sample still kept to path, oldest first, as a line of json each. Returns false on error.
+bool telemetry_export(telemetry_t *tel, const char *path);
+
+//  MB/s of bytes over ticks.
+double telemetry_rate(u64 bytes, u64 ticks);
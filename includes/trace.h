@@ -0,0 +1,21 @@
+#pragma once
+
+#include "console.h"
+
+/*
+*   Tracing for following what the threads are doing.
+*
+*   TRACE_LEVEL is set at build time. Anything above it is a constant false if,
+*   so the compiler removes the call and its arguments entirely.
+*   Errors are not traced, they are always printed.
+*/
+#define TRACE_NONE  0
+#define TRACE_INFO  1   // once per file / lane.
+#define TRACE_DEBUG 2   // once per chunk, very slow.
+
+#ifndef TRACE_LEVEL
+    #define TRACE_LEVEL TRACE_NONE
+#endif
+
+#define TRACE(level, ...) \
+    do { if (TRACE_LEVEL >= (level)) print_console(__VA_ARGS__); } while (0)
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <switch.h>
+
+/*
+*   A transform changes each chunk on its way from the reader to the writer, such as compressing it.
+*   Chunks are independent of each other, so a lane can run several transform threads at once
+*   (a striped ring stage, see ring.h) and the chunks still reach the writer in order.
+*
+*   Compressing writes every chunk as a zstd frame, after a zstd skippable frame
+*   of TRANSFORM_HEADER_SIZE that holds the size of the frame that follows, the size it decompresses to,
+*   and the chunk size of the copy that compressed it (which no frame in the file decompresses to more than).
+*   The whole file is still a normal .zst that any zstd can decompress,
+*   and decompressing here reads one header + frame per slot, so it never has to search for frames.
+*   A slot has to be big enough for both, so decompressing needs the chunk size the file was compressed with.
+*
+*   zstd is only there when built with USE_ZSTD=1 (needs the switch-zstd portlib).
+*/
+typedef enum
+{
+    TransformType_None,
+    TransformType_Compress,
+    TransformType_Decompress,
+} TransformType;
+
+#define TRANSFORM_HEADER_SIZE     20
+#define TRANSFORM_MAX_WORKERS     4
+#define DEFAULT_TRANSFORM_WORKERS 2
+#define DEFAULT_TRANSFORM_LEVEL   3
+
+typedef struct
+{
+    TransformType type;
+    void *ctx;
+    size_t chunk_size;      // compressing, the copy's chunk size to put in each header.
+} transform_t;
+
+typedef struct
+{
+    size_t frame_size;
+    size_t content_size;    // of the frame once decompressed.
+    size_t chunk_size;      // the copy that compressed it.
+} transform_header_t;
+
+//  Returns false if this build can't do the transform.
+bool transform_available(TransformType type);
+
+//  Each transform thread has its own, as the contexts are not thread safe.
+bool transform_init(transform_t *t, TransformType type, int level, size_t chunk_size);
+void transform_exit(transform_t *t);
+
+//  The buffer size for chunks of in_size, which holds a header + frame compressed from in_size bytes.
+//  Decompressing, in_size has to be at least the chunk size the file was compressed with.
+size_t transform_bound(TransformType type, size_t in_size);
+
+//  Compresses / decompresses in to out, returning false on error (including out being too small, or TransformType_None).
+bool transform_run(transform_t *t, const void *in, size_t in_size, void *out, size_t out_cap, size_t *out_size);
+
+//  Reads a header, returns false if it isn't one of ours.
+bool transform_parse_header(const void *header, transform_header_t *out);
+
+const char *transform_name(TransformType type);
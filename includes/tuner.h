@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <switch.h>
+
+/*
+*   Adaptive chunk size.
+*
+*   Different storage wants very different request sizes, so rather than a fixed size
+*   the read thread starts at TUNER_PROBE_SIZE and hill climbs from there.
+*   After each window of chunks at one size, the speed of the slowest stage
+*   (read or write, as that is the rate the lane can run at) is compared to the last window.
+*   Faster keeps doubling / halving in the same direction, slower turns around,
+*   and about the same stays put until the speed changes.
+*
+*   The size never goes above the slot size, so it always fits in the memory already allocated.
+*   Only ever used by the read thread, the write times come back with the slots.
+*/
+#define TUNER_PROBE_SIZE     0x100000
+#define TUNER_MIN_SIZE       0x10000
+#define TUNER_WINDOW_CHUNKS  4
+#define TUNER_WINDOW_BYTES   0x1000000
+
+typedef struct
+{
+    size_t min_size;
+    size_t max_size;
+    size_t size;            // chunk size to use now.
+    int direction;          // 1 to grow, -1 to shrink.
+    double last_mbs;        // speed of the last window, < 0 if there wasn't one.
+    u64 read_bytes;
+    u64 read_ticks;
+    size_t read_chunks;
+    u64 write_bytes;
+    u64 write_ticks;
+    size_t write_chunks;
+} chunk_tuner_t;
+
+void tuner_init(chunk_tuner_t *tuner, size_t max_size);
+
+//  Only samples taken at the current size count towards the window.
+void tuner_add_read(chunk_tuner_t *tuner, size_t chunk_size, size_t bytes, u64 ticks);
+void tuner_add_write(chunk_tuner_t *tuner, size_t chunk_size, size_t bytes, u64 ticks);
+
+//  Returns the chunk size to use for the next read, moving on once a window is complete.
+size_t tuner_next(chunk_tuner_t *tuner);
@@ -0,0 +1,689 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <threads.h>
+#include <unistd.h>
+#include <switch.h>
+
+#include "bench.h"
+#include "console.h"
+#include "copy.h"
+#include "copy_engine.h"
+#include "file_io.h"
+#include "mem.h"
+
+#define BENCH_MAX_SPLIT 4
+
+#define BENCH_CSV "sdmc:/switch/thread-example-bench.csv"
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/*
+*   The grid swept by bench_sweep.
+*   Combinations that need more than BENCH_MAX_MEMORY of slots are skipped.
+*/
+#define BENCH_MAX_MEMORY 0xC000000
+
+static const size_t bench_chunk_sizes[] = { 0x10000, 0x40000, 0x100000, 0x400000, 0x800000, 0x1000000, 0x2000000 };
+static const size_t bench_slot_counts[] = { 2, 4, 8 };
+static const size_t bench_lane_counts[] = { 1, 2, 3 };
+static const FileBackend bench_backends[] = { FileBackend_Stdio, FileBackend_Native };
+
+typedef struct
+{
+    const char *name;
+    const char *dir;
+} bench_device_t;
+
+static const bench_device_t bench_devices[] =
+{
+    { "sd",   "sdmc:/switch/thread-example-bench" },
+    { "nand", "user:/thread-example-bench" },
+};
+
+
+//  Mounts the nand user partition as "user:/".
+static bool mount_nand(void)
+{
+    FsFileSystem fs;
+    if (R_FAILED(fsOpenBisFileSystem(&fs, FsBisPartitionId_User, ""))) return false;
+    if (fsdevMountDevice("user", fs) == -1)
+    {
+        fsFsClose(&fs);
+        return false;
+    }
+    return true;
+}
+
+//  Writes size bytes of a pattern that isn't all zeros, so nothing can take shortcuts with it.
+static bool make_test_file(const char *path, size_t size, FileBackend backend)
+{
+    u32 *buf = malloc(BUFSIZE);
+    if (!buf) return false;
+
+    file_t file;
+    if (!file_open_write(&file, backend, path))
+    {
+        free(buf);
+        return false;
+    }
+
+    bool ok = true;
+    u32 x = 0x12345678;
+    for (size_t done = 0; ok && done < size; done += BUFSIZE)
+    {
+        for (size_t i = 0; i < BUFSIZE / sizeof(u32); i++)
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            buf[i] = x;
+        }
+
+        size_t chunk = size - done < BUFSIZE ? size - done : BUFSIZE;
+        ok = file_write(&file, buf, chunk) == chunk;
+    }
+
+    file_close(&file);
+    free(buf);
+    return ok;
+}
+
+static bool files_match(const char *a, const char *b, FileBackend backend)
+{
+    u8 *buf_a = malloc(BUFSIZE);
+    u8 *buf_b = malloc(BUFSIZE);
+    file_t file_a, file_b;
+    bool open_a = buf_a && buf_b && file_open_read(&file_a, backend, a);
+    bool open_b = open_a && file_open_read(&file_b, backend, b);
+
+    bool match = open_b;
+    while (match)
+    {
+        size_t read_a = file_read(&file_a, buf_a, BUFSIZE);
+        size_t read_b = file_read(&file_b, buf_b, BUFSIZE);
+        match = read_a == read_b && mem_equal(buf_a, buf_b, read_a);
+        if (read_a < BUFSIZE) break;
+    }
+
+    if (open_b) file_close(&file_b);
+    if (open_a) file_close(&file_a);
+    free(buf_b);
+    free(buf_a);
+    return match;
+}
+
+//  Returns MB/s, or a negative value on error. The stats are optional.
+static double timed_copy(const copy_opts_t *opts, const char *src, const char *dst, size_t size,
+    stage_stats_t stats[Stage_Count])
+{
+    copy_engine_t engine;
+    if (!copy_engine_start(&engine, opts)) return -1.0;
+
+    u64 start = armGetSystemTick();
+    bool added = copy_engine_add_file(&engine, src, dst);
+    copy_engine_finish(&engine);
+    u64 ns = armTicksToNs(armGetSystemTick() - start);
+
+    if (stats) copy_engine_stats(&engine, stats);
+    bool failed = !added || copy_engine_failed(&engine);
+    copy_engine_exit(&engine);
+    if (failed || ns == 0) return -1.0;
+
+    return (double)size / (1024.0 * 1024.0) / ((double)ns / 1e9);
+}
+
+void bench_split(const copy_opts_t *opts, size_t file_size)
+{
+    bool nand_mounted = mount_nand();
+    if (!nand_mounted) print_console("failed to mount nand, skipping it\n\n");
+
+    //  Only the native backend splits, and hashing, transforming or dedup would stop it from splitting too.
+    if (opts->backend != FileBackend_Native) print_console("files are only split with the native backend, using it\n\n");
+    print_console("split benchmark, %lu MiB file, %s backend\n\n", file_size >> 20, file_backend_name(FileBackend_Native));
+
+    for (size_t d = 0; d < sizeof(bench_devices) / sizeof(bench_devices[0]); d++)
+    {
+        const bench_device_t *dev = &bench_devices[d];
+        if (!strcmp(dev->name, "nand") && !nand_mounted) continue;
+
+        char src[FS_MAX_PATH];
+        char dst[FS_MAX_PATH];
+        snprintf(src, sizeof(src), "%s/src.bin", dev->dir);
+        snprintf(dst, sizeof(dst), "%s/dst.bin", dev->dir);
+
+        mkdir(dev->dir, 0777);
+        if (!make_test_file(src, file_size, FileBackend_Native))
+        {
+            print_console("%s: failed to create test file\n\n", dev->name);
+            continue;
+        }
+
+        double base = 0.0;
+        for (size_t k = 1; k <= BENCH_MAX_SPLIT; k++)
+        {
+            copy_opts_t split_opts = *opts;
+            split_opts.split_count = k;
+            split_opts.split_threshold = 0;
+            split_opts.lane_count = k;
+            split_opts.adaptive = false;
+            split_opts.pool = NULL;
+            split_opts.backend = FileBackend_Native;
+            split_opts.hash = HashType_None;
+            split_opts.verify = false;
+            split_opts.transform = TransformType_None;
+            split_opts.dedup_dir = NULL;
+
+            double mbs = timed_copy(&split_opts, src, dst, file_size, NULL);
+            bool match = mbs >= 0.0 && files_match(src, dst, FileBackend_Native);
+            if (k == 1) base = mbs;
+
+            if (!match)
+            {
+                print_console("%s: K=%lu failed or output differs\n", dev->name, k);
+            }
+            else
+            {
+                print_console("%s: K=%lu %8.2f MB/s (x%.2f)\n", dev->name, k, mbs, base > 0.0 ? mbs / base : 0.0);
+            }
+            remove(dst);
+        }
+
+        remove(src);
+        rmdir(dev->dir);
+        print_console("\n");
+    }
+
+    if (nand_mounted) fsdevUnmountDevice("user");
+}
+
+//  Seconds of a timer, for the csv.
+static double timer_sec(const stage_stats_t *stats, StatTimer timer)
+{
+    return (double)armTicksToNs(stats->timers[timer].ticks) / 1e9;
+}
+
+void bench_sweep(const copy_opts_t *opts, size_t file_size)
+{
+    FILE *csv = fopen(BENCH_CSV, "w");
+    if (!csv)
+    {
+        print_console("failed to create %s\n\n", BENCH_CSV);
+        return;
+    }
+    fprintf(csv, "device,backend,chunk_size,slots,lanes,bytes,mb_s,read_io_s,write_io_s,read_wait_s,write_wait_s,ok\n");
+
+    bool nand_mounted = mount_nand();
+    if (!nand_mounted) print_console("failed to mount nand, skipping it\n\n");
+
+    print_console("sweep benchmark, %lu MiB file, results in %s\n\n", file_size >> 20, BENCH_CSV);
+
+    for (size_t d = 0; d < ARRAY_SIZE(bench_devices); d++)
+    {
+        const bench_device_t *dev = &bench_devices[d];
+        if (!strcmp(dev->name, "nand") && !nand_mounted) continue;
+
+        char src[FS_MAX_PATH];
+        char dst[FS_MAX_PATH];
+        snprintf(src, sizeof(src), "%s/src.bin", dev->dir);
+        snprintf(dst, sizeof(dst), "%s/dst.bin", dev->dir);
+
+        mkdir(dev->dir, 0777);
+        if (!make_test_file(src, file_size, opts->backend))
+        {
+            print_console("%s: failed to create test file\n\n", dev->name);
+            continue;
+        }
+
+        //  Best of each device, printed at the end so there's something to read on screen.
+        copy_opts_t best = *opts;
+        double best_mbs = -1.0;
+
+        for (size_t b = 0; b < ARRAY_SIZE(bench_backends); b++)
+        for (size_t c = 0; c < ARRAY_SIZE(bench_chunk_sizes); c++)
+        for (size_t n = 0; n < ARRAY_SIZE(bench_slot_counts); n++)
+        for (size_t l = 0; l < ARRAY_SIZE(bench_lane_counts); l++)
+        {
+            copy_opts_t run = *opts;
+            run.backend = bench_backends[b];
+            run.chunk_size = bench_chunk_sizes[c];
+            run.slot_count = bench_slot_counts[n];
+            run.lane_count = bench_lane_counts[l];
+            run.adaptive = false;
+            run.pool = NULL;
+
+            //  A single file only uses more than one lane if it is split.
+            run.split_count = run.lane_count;
+            run.split_threshold = 0;
+
+            if (run.chunk_size * run.slot_count * run.lane_count > BENCH_MAX_MEMORY) continue;
+
+            stage_stats_t stats[Stage_Count];
+            double mbs = timed_copy(&run, src, dst, file_size, stats);
+            bool ok = mbs >= 0.0 && files_match(src, dst, opts->backend);
+            remove(dst);
+
+            fprintf(csv, "%s,%s,%lu,%lu,%lu,%lu,%.3f,%.4f,%.4f,%.4f,%.4f,%d\n",
+                dev->name, file_backend_name(run.backend), run.chunk_size, run.slot_count, run.lane_count,
+                file_size, ok ? mbs : 0.0,
+                ok ? timer_sec(&stats[Stage_Read], StatTimer_Io) : 0.0, ok ? timer_sec(&stats[Stage_Write], StatTimer_Io) : 0.0,
+                ok ? timer_sec(&stats[Stage_Read], StatTimer_Wait) : 0.0, ok ? timer_sec(&stats[Stage_Write], StatTimer_Wait) : 0.0,
+                ok);
+
+            print_console("\r%s: %s %5lu KiB x%lu, %lu lanes: %8.2f MB/s   ",
+                dev->name, file_backend_name(run.backend), run.chunk_size >> 10, run.slot_count, run.lane_count, ok ? mbs : 0.0);
+
+            if (ok && mbs > best_mbs)
+            {
+                best_mbs = mbs;
+                best = run;
+            }
+        }
+
+        print_console("\n%s best: %s %lu KiB x%lu, %lu lanes: %.2f MB/s\n\n",
+            dev->name, file_backend_name(best.backend), best.chunk_size >> 10, best.slot_count, best.lane_count, best_mbs);
+
+        remove(src);
+        rmdir(dev->dir);
+    }
+
+    if (nand_mounted) fsdevUnmountDevice("user");
+    fclose(csv);
+}
+
+typedef enum
+{
+    MemKernel_Memcpy,
+    MemKernel_MemCopy,
+    MemKernel_Memcmp,
+    MemKernel_MemEqual,
+    MemKernel_Count,
+} MemKernel;
+
+static const char *mem_kernel_names[MemKernel_Count] = { "memcpy", "mem_copy", "memcmp", "mem_equal" };
+
+//  Returns MB/s of running kernel over total bytes of a and b.
+static double time_mem_kernel(MemKernel kernel, u8 *a, u8 *b, size_t total)
+{
+    //  Stops the compares being thrown away.
+    volatile size_t equal = 0;
+
+    u64 start = armGetSystemTick();
+    for (size_t done = 0; done < total; done += BENCH_MEM_CHUNK)
+    {
+        //  The buffers could have changed as far as the compiler knows, so memcmp can't be
+        //  worked out once and hoisted out of the loop.
+        __asm__ volatile("" ::: "memory");
+        switch (kernel)
+        {
+            case MemKernel_Memcpy:   memcpy(b, a, BENCH_MEM_CHUNK); break;
+            case MemKernel_MemCopy:  mem_copy(b, a, BENCH_MEM_CHUNK); break;
+            case MemKernel_Memcmp:   equal += !memcmp(a, b, BENCH_MEM_CHUNK); break;
+            case MemKernel_MemEqual: equal += mem_equal(a, b, BENCH_MEM_CHUNK); break;
+            default: break;
+        }
+    }
+    u64 ns = armTicksToNs(armGetSystemTick() - start);
+
+    (void)equal;
+    return ns ? (double)total / (1024.0 * 1024.0) / ((double)ns / 1e9) : 0.0;
+}
+
+void bench_mem(size_t total)
+{
+    u8 *a = aligned_alloc(POOL_ALIGN, BENCH_MEM_CHUNK);
+    u8 *b = aligned_alloc(POOL_ALIGN, BENCH_MEM_CHUNK);
+    if (!a || !b)
+    {
+        print_console("failed to allocate %u KiB buffers\n\n", BENCH_MEM_CHUNK >> 10);
+        free(b);
+        free(a);
+        return;
+    }
+
+    //  Equal buffers, so the compares have to go all the way to the end.
+    for (size_t i = 0; i < BENCH_MEM_CHUNK; i++)
+    {
+        a[i] = (u8)(i * 31 + 7);
+    }
+    memcpy(b, a, BENCH_MEM_CHUNK);
+
+    if (total < BENCH_MEM_CHUNK) total = BENCH_MEM_CHUNK;
+    print_console("memory benchmark, %lu MiB in %u KiB buffers\n\n", total >> 20, BENCH_MEM_CHUNK >> 10);
+
+    //  Each pair is newlib and then ours.
+    for (size_t k = 0; k < MemKernel_Count; k += 2)
+    {
+        double base = time_mem_kernel(k, a, b, total);
+        double mbs = time_mem_kernel(k + 1, a, b, total);
+        print_console("%-9s %8.2f MB/s\n", mem_kernel_names[k], base);
+        print_console("%-9s %8.2f MB/s (x%.2f)\n", mem_kernel_names[k + 1], mbs, base > 0.0 ? mbs / base : 0.0);
+    }
+    print_console("\n");
+
+    if (!mem_equal(a, b, BENCH_MEM_CHUNK)) print_console("mem_copy output differs!\n\n");
+
+    free(b);
+    free(a);
+}
+
+typedef enum
+{
+    Handoff_Threads,    // threads.h mtx_t / cnd_t, how the ring handed over slots before sync.h.
+    Handoff_Block,      // the ring, blocking straight away.
+    Handoff_Spin,       // the ring, spinning first.
+    Handoff_Count,
+} Handoff;
+
+static const char *handoff_names[Handoff_Count] = { "threads.h", "block", "spin then block" };
+
+//  Just enough of a ring to hand over slots through threads.h, for the baseline.
+typedef struct
+{
+    mtx_t mtx;
+    cnd_t can_push;
+    cnd_t can_pop;
+    size_t head;
+    size_t tail;
+    u64 sent[BENCH_HANDOFF_SLOTS];
+    bool eof[BENCH_HANDOFF_SLOTS];
+} cnd_ring_t;
+
+typedef struct
+{
+    ring_t ring;
+    cnd_ring_t cnd;
+    size_t count;
+    stat_timer_t latency;
+} handoff_t;
+
+//  Busy rather than asleep, so that waking up the sender isn't part of what is timed.
+static void handoff_gap(void)
+{
+    u64 gap = armNsToTicks(BENCH_HANDOFF_GAP_US * 1000ULL);
+    for (u64 start = armGetSystemTick(); armGetSystemTick() - start < gap; );
+}
+
+static void cnd_push(cnd_ring_t *r, bool eof)
+{
+    mtx_lock(&r->mtx);
+    while (r->head - r->tail == BENCH_HANDOFF_SLOTS) cnd_wait(&r->can_push, &r->mtx);
+    r->eof[r->head % BENCH_HANDOFF_SLOTS] = eof;
+    r->sent[r->head % BENCH_HANDOFF_SLOTS] = armGetSystemTick();
+    r->head++;
+    cnd_signal(&r->can_pop);
+    mtx_unlock(&r->mtx);
+}
+
+static void thrd_cnd_send(void *in)
+{
+    handoff_t *h = (handoff_t *)in;
+
+    for (size_t i = 0; i <= h->count; i++)
+    {
+        handoff_gap();
+        cnd_push(&h->cnd, i == h->count);
+    }
+}
+
+static void thrd_cnd_recv(void *in)
+{
+    handoff_t *h = (handoff_t *)in;
+    cnd_ring_t *r = &h->cnd;
+
+    for (bool eof = false; !eof; )
+    {
+        mtx_lock(&r->mtx);
+        while (r->head == r->tail) cnd_wait(&r->can_pop, &r->mtx);
+        u64 now = armGetSystemTick();
+        eof = r->eof[r->tail % BENCH_HANDOFF_SLOTS];
+        if (!eof) stats_add(&h->latency, now - r->sent[r->tail % BENCH_HANDOFF_SLOTS]);
+        r->tail++;
+        cnd_signal(&r->can_push);
+        mtx_unlock(&r->mtx);
+    }
+}
+
+static void thrd_handoff_send(void *in)
+{
+    handoff_t *h = (handoff_t *)in;
+
+    for (size_t i = 0; i <= h->count; i++)
+    {
+        handoff_gap();
+
+        slot_t *slot = ring_claim(&h->ring);
+        if (!slot) return;
+        slot->eof = i == h->count;
+        slot->read_ticks = armGetSystemTick();
+        ring_push(&h->ring);
+    }
+}
+
+static void thrd_handoff_recv(void *in)
+{
+    handoff_t *h = (handoff_t *)in;
+
+    for (;;)
+    {
+        slot_t *slot = ring_peek(&h->ring);
+        if (!slot) return;
+        u64 now = armGetSystemTick();
+        bool eof = slot->eof;
+        if (!eof) stats_add(&h->latency, now - slot->read_ticks);
+        ring_pop(&h->ring);
+        if (eof) return;
+    }
+}
+
+//  Returns false if the threads couldn't be started.
+static bool time_handoff(handoff_t *h, buffer_pool_t *pool, Handoff mode)
+{
+    const size_t group_sizes[] = { 1, 1 };
+    memset(&h->latency, 0, sizeof(h->latency));
+    if (mode == Handoff_Threads)
+    {
+        memset(&h->cnd, 0, sizeof(h->cnd));
+        if (mtx_init(&h->cnd.mtx, mtx_plain) != thrd_success) return false;
+        if (cnd_init(&h->cnd.can_push) != thrd_success)
+        {
+            mtx_destroy(&h->cnd.mtx);
+            return false;
+        }
+        if (cnd_init(&h->cnd.can_pop) != thrd_success)
+        {
+            cnd_destroy(&h->cnd.can_push);
+            mtx_destroy(&h->cnd.mtx);
+            return false;
+        }
+    }
+    else
+    {
+        if (!ring_init(&h->ring, BENCH_HANDOFF_SLOTS, group_sizes, 2, pool, false)) return false;
+        ring_set_spin(&h->ring, mode == Handoff_Spin);
+    }
+
+    ThreadFunc send_fn = mode == Handoff_Threads ? thrd_cnd_send : thrd_handoff_send;
+    ThreadFunc recv_fn = mode == Handoff_Threads ? thrd_cnd_recv : thrd_handoff_recv;
+
+    Thread send, recv;
+    bool ok = false;
+    if (R_SUCCEEDED(threadCreate(&send, send_fn, h, NULL, 0x10000, 0x2C, 0)))
+    {
+        if (R_SUCCEEDED(threadCreate(&recv, recv_fn, h, NULL, 0x10000, 0x2C, 1)))
+        {
+            if (R_SUCCEEDED(threadStart(&recv)))
+            {
+                ok = R_SUCCEEDED(threadStart(&send));
+                if (ok) threadWaitForExit(&send);
+                //  Otherwise the receiver is waiting for a slot that will never come.
+                else if (mode == Handoff_Threads) cnd_push(&h->cnd, true);
+                else ring_cancel(&h->ring);
+                threadWaitForExit(&recv);
+            }
+            threadClose(&recv);
+        }
+        threadClose(&send);
+    }
+
+    if (mode == Handoff_Threads)
+    {
+        cnd_destroy(&h->cnd.can_pop);
+        cnd_destroy(&h->cnd.can_push);
+        mtx_destroy(&h->cnd.mtx);
+    }
+    else ring_exit(&h->ring);
+    return ok;
+}
+
+void bench_handoff(size_t count)
+{
+    buffer_pool_t pool;
+    if (!pool_init(&pool, POOL_ALIGN, BENCH_HANDOFF_SLOTS))
+    {
+        print_console("failed to allocate the ring\n\n");
+        return;
+    }
+
+    handoff_t *h = calloc(1, sizeof(handoff_t));
+    if (!h)
+    {
+        pool_exit(&pool);
+        return;
+    }
+    h->count = count ? count : 1;
+
+    print_console("handoff benchmark, %lu slots, %u us apart\n\n", h->count, BENCH_HANDOFF_GAP_US);
+    double base = 0.0;
+    for (Handoff mode = 0; mode < Handoff_Count; mode++)
+    {
+        if (!time_handoff(h, &pool, mode))
+        {
+            print_console("failed to start the threads\n\n");
+            break;
+        }
+
+        stat_timer_t *lat = &h->latency;
+        double avg_us = lat->count ? (double)armTicksToNs(lat->ticks / lat->count) / 1000.0 : 0.0;
+        if (mode == Handoff_Threads) base = avg_us;
+        print_console("%-16s avg %8.2f us, max %8.2f us (x%.2f)\n", handoff_names[mode], avg_us,
+            (double)armTicksToNs(lat->max_ticks) / 1000.0, avg_us > 0.0 ? base / avg_us : 0.0);
+    }
+    print_console("\n");
+
+    free(h);
+    pool_exit(&pool);
+}
+
+//  Copies small whilst another copy of big runs, as other_class, or on its own if there's no big.
+//  Returns the seconds small took, or a negative value on error or if the other copy finished first.
+//  other_done is how much the other copy got done meanwhile.
+static double time_alongside(const copy_opts_t *opts, const char *small, const char *big, const char *dir,
+    CopyClass small_class, CopyClass other_class, size_t *other_done)
+{
+    char small_dst[FS_MAX_PATH];
+    char big_dst[FS_MAX_PATH];
+    snprintf(small_dst, sizeof(small_dst), "%s/small_dst.bin", dir);
+    snprintf(big_dst, sizeof(big_dst), "%s/big_dst.bin", dir);
+
+    sched_t sched;
+    if (!sched_init(&sched)) return -1.0;
+
+    //  Each copy makes its own slots, so that neither waits on the other for buffers.
+    copy_opts_t small_opts = *opts;
+    small_opts.pool = NULL;
+    small_opts.sched = &sched;
+    small_opts.copy_class = small_class;
+    copy_opts_t other_opts = small_opts;
+    other_opts.copy_class = other_class;
+
+    copy_task_t *other = NULL;
+    if (big)
+    {
+        other = copy_start(big, big_dst, &other_opts, NULL, NULL, NULL);
+        if (!other)
+        {
+            sched_exit(&sched);
+            return -1.0;
+        }
+        svcSleepThread(BENCH_SCHED_HEAD_START_MS * 1000000ULL);
+    }
+
+    size_t before = 0;
+    if (other) copy_poll(other, &before, NULL);
+
+    u64 start = armGetSystemTick();
+    copy_task_t *task = copy_start(small, small_dst, &small_opts, NULL, NULL, NULL);
+    bool ok = task && copy_wait(task);
+    u64 ns = armTicksToNs(armGetSystemTick() - start);
+    if (task) copy_free(task);
+    ok = ok && files_match(small, small_dst, opts->backend);
+    remove(small_dst);
+
+    size_t after = 0;
+    bool overlapped = !other || !copy_poll(other, &after, NULL);
+    if (other)
+    {
+        copy_cancel(other);
+        copy_free(other);
+        remove(big_dst);
+    }
+    sched_exit(&sched);
+
+    *other_done = after - before;
+    if (!ok || !overlapped || ns == 0) return -1.0;
+    return (double)ns / 1e9;
+}
+
+void bench_sched(const copy_opts_t *opts, size_t file_size)
+{
+    const bench_device_t *dev = &bench_devices[0];
+    size_t small_size = file_size / BENCH_SCHED_SMALL;
+
+    char small[FS_MAX_PATH];
+    char big[FS_MAX_PATH];
+    snprintf(small, sizeof(small), "%s/small.bin", dev->dir);
+    snprintf(big, sizeof(big), "%s/big.bin", dev->dir);
+
+    print_console("sched benchmark, %lu MiB next to %lu MiB, on %s\n\n", small_size >> 20, file_size >> 20, dev->name);
+
+    mkdir(dev->dir, 0777);
+    if (!make_test_file(small, small_size, opts->backend) || !make_test_file(big, file_size, opts->backend))
+    {
+        print_console("%s: failed to create test files\n\n", dev->name);
+        remove(small);
+        remove(big);
+        rmdir(dev->dir);
+        return;
+    }
+
+    size_t other_done;
+    double alone = time_alongside(opts, small, NULL, dev->dir, CopyClass_Interactive, CopyClass_Count, &other_done);
+    if (alone < 0.0) print_console("alone:                  failed or output differs\n");
+    else print_console("alone:                  %8.2f s\n", alone);
+
+    static const CopyClass classes[][2] =
+    {
+        { CopyClass_Interactive, CopyClass_Bulk },
+        { CopyClass_Normal, CopyClass_Normal },
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(classes); i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%s next to %s:", copy_class_name(classes[i][0]), copy_class_name(classes[i][1]));
+
+        double secs = time_alongside(opts, small, big, dev->dir, classes[i][0], classes[i][1], &other_done);
+        if (secs < 0.0)
+        {
+            print_console("%-23s failed, or the %s copy finished first\n", name, copy_class_name(classes[i][1]));
+            continue;
+        }
+        print_console("%-23s %8.2f s (x%.2f), the %s copy did %lu MiB meanwhile\n",
+            name, secs, alone > 0.0 ? secs / alone : 0.0, copy_class_name(classes[i][1]), other_done >> 20);
+    }
+    print_console("\n");
+
+    remove(small);
+    remove(big);
+    rmdir(dev->dir);
+}
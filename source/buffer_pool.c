@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer_pool.h"
+
+
+bool pool_init(buffer_pool_t *pool, size_t buffer_size, size_t buffer_count)
+{
+    if (!pool || !buffer_size || !buffer_count) return false;
+
+    memset(pool, 0, sizeof(buffer_pool_t));
+    pool->buffer_size = (buffer_size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    pool->buffer_count = buffer_count;
+
+    if (mtx_init(&pool->mtx, mtx_plain) != thrd_success) return false;
+    if (cnd_init(&pool->freed) != thrd_success)
+    {
+        mtx_destroy(&pool->mtx);
+        return false;
+    }
+
+    pool->arena = aligned_alloc(POOL_ALIGN, pool->buffer_size * buffer_count);
+    pool->free_list = malloc(sizeof(void *) * buffer_count);
+    if (!pool->arena || !pool->free_list)
+    {
+        pool_exit(pool);
+        return false;
+    }
+
+    for (size_t i = 0; i < buffer_count; i++)
+    {
+        pool->free_list[i] = (char *)pool->arena + i * pool->buffer_size;
+    }
+    pool->free_count = buffer_count;
+
+    return true;
+}
+
+void pool_exit(buffer_pool_t *pool)
+{
+    free(pool->free_list);
+    free(pool->arena);
+    pool->free_list = NULL;
+    pool->arena = NULL;
+    pool->free_count = 0;
+    cnd_destroy(&pool->freed);
+    mtx_destroy(&pool->mtx);
+}
+
+void *pool_lease(buffer_pool_t *pool)
+{
+    void *buffer = NULL;
+
+    mtx_lock(&pool->mtx);
+    if (pool->free_count) buffer = pool->free_list[--pool->free_count];
+    mtx_unlock(&pool->mtx);
+
+    return buffer;
+}
+
+void pool_return(buffer_pool_t *pool, void *buffer)
+{
+    if (!buffer) return;
+
+    mtx_lock(&pool->mtx);
+    pool->free_list[pool->free_count++] = buffer;
+    cnd_broadcast(&pool->freed);
+    mtx_unlock(&pool->mtx);
+}
+
+bool pool_lease_many(buffer_pool_t *pool, void **out, size_t count)
+{
+    mtx_lock(&pool->mtx);
+    bool ok = pool->free_count >= count;
+    for (size_t i = 0; ok && i < count; i++)
+    {
+        out[i] = pool->free_list[--pool->free_count];
+    }
+    mtx_unlock(&pool->mtx);
+
+    return ok;
+}
+
+bool pool_wait(buffer_pool_t *pool, size_t count, u64 timeout_ns)
+{
+    if (count > pool->buffer_count) return false;
+
+    struct timespec until;
+    timespec_get(&until, TIME_UTC);
+    until.tv_sec += timeout_ns / 1000000000ULL;
+    until.tv_nsec += timeout_ns % 1000000000ULL;
+    if (until.tv_nsec >= 1000000000L)
+    {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+
+    mtx_lock(&pool->mtx);
+    while (pool->free_count < count)
+    {
+        if (cnd_timedwait(&pool->freed, &pool->mtx, &until) != thrd_success) break;
+    }
+    bool ok = pool->free_count >= count;
+    mtx_unlock(&pool->mtx);
+
+    return ok;
+}
+
+size_t pool_free_count(buffer_pool_t *pool)
+{
+    mtx_lock(&pool->mtx);
+    size_t count = pool->free_count;
+    mtx_unlock(&pool->mtx);
+
+    return count;
+}
@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <switch.h>
+#include <threads.h>
+
+#include "console.h"
+
+
+//  The console mtx is for when we want to write to stdout and update the console.
+static mtx_t console_mtx;
+
+
+bool console_init(void)
+{
+    if (!consoleInit(NULL)) return false;
+    if (mtx_init(&console_mtx, mtx_plain) != thrd_success) return false;
+    return true;
+}
+
+void console_exit(void)
+{
+    consoleExit(NULL);
+    mtx_destroy(&console_mtx);
+}
+
+void print_console(const char *text, ...)
+{
+    mtx_lock(&console_mtx);
+
+    va_list v;
+    va_start(v, text);
+    vfprintf(stdout, text, v);
+    va_end(v);
+    consoleUpdate(NULL);
+
+    mtx_unlock(&console_mtx);
+}
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <switch.h>
+
+#include "copy.h"
+
+
+//  Low priority, it only wakes up to report progress.
+#define COPY_THREAD_PRIO 0x3B
+
+
+static bool is_dir(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void sample_telemetry(copy_task_t *task, bool force)
+{
+    copy_engine_t *e = &task->engine;
+    telemetry_counters_t now =
+    {
+        .bytes_read = copy_engine_data_read(e),
+        .bytes_written = copy_engine_data_written(e),
+        .stall_ticks = copy_engine_stall_ticks(e),
+        .queue_depth = copy_engine_queue_depth(e),
+    };
+    telemetry_update(&task->telemetry, &now, force);
+}
+
+static void report_progress(copy_task_t *task)
+{
+    size_t done = copy_engine_data_done(&task->engine);
+    size_t total = atomic_load(&task->total_size);
+    atomic_store(&task->data_done, done);
+    if (task->on_progress) task->on_progress(done, total, armGetSystemTick() - task->start_tick, task->user);
+}
+
+//  A shared pool may have all of its buffers leased by other copies, so this waits until
+//  there are enough for a lane. Starting can still lose them to another copy, then it waits again.
+//  Any other reason for not starting won't go away by waiting.
+static bool start_engine(copy_task_t *task)
+{
+    buffer_pool_t *pool = task->opts.pool;
+    size_t lane_buffers = copy_engine_lane_buffers(&task->opts);
+
+    for (;;)
+    {
+        if (pool && !pool_wait(pool, lane_buffers, COPY_PROGRESS_INTERVAL_MS * 1000000ULL))
+        {
+            //  A pool that's too small will never have enough.
+            mtx_lock(&task->mtx);
+            bool cancelled = task->cancelled;
+            mtx_unlock(&task->mtx);
+            if (cancelled || lane_buffers > pool->buffer_count) return false;
+            continue;
+        }
+
+        mtx_lock(&task->mtx);
+        task->running = !task->cancelled && copy_engine_start(&task->engine, &task->opts);
+        bool started = task->running;
+        bool cancelled = task->cancelled;
+        mtx_unlock(&task->mtx);
+
+        if (started || cancelled || !pool || !task->engine.out_of_buffers) return started;
+    }
+}
+
+static void thrd_copy(void *in)
+{
+    copy_task_t *task = (copy_task_t *)in;
+    copy_engine_t *e = &task->engine;
+
+    bool started = start_engine(task);
+
+    if (started)
+    {
+        task->added = is_dir(task->src) ? copy_engine_add_dir(e, task->src, task->dst)
+            : copy_engine_add_file(e, task->src, task->dst);
+        atomic_store(&task->total_size, e->total_size);
+
+        while (!copy_engine_wait(e, COPY_PROGRESS_INTERVAL_MS * 1000000ULL))
+        {
+            sample_telemetry(task, false);
+            report_progress(task);
+        }
+
+        //  Every lane has stopped, so there is nothing left to cancel.
+        mtx_lock(&task->mtx);
+        task->running = false;
+        bool cancelled = task->cancelled;
+        mtx_unlock(&task->mtx);
+
+        //  The last of the copy, before verify reads everything back.
+        sample_telemetry(task, true);
+        copy_engine_finish(e);
+        report_progress(task);
+        task->ok = task->added && !cancelled && copy_engine_failed(e) == 0;
+    }
+
+    atomic_store(&task->done, true);
+    if (task->on_done) task->on_done(task, task->ok, task->user);
+}
+
+copy_task_t *copy_start(const char *src, const char *dst, const copy_opts_t *opts,
+    copy_progress_fn on_progress, copy_done_fn on_done, void *user)
+{
+    if (!src || !dst || !opts) return NULL;
+
+    copy_task_t *task = calloc(1, sizeof(copy_task_t));
+    if (!task) return NULL;
+
+    //  The engine starts on the task's own low priority thread, so the default is
+    //  the priority of the thread starting the copy, worked out here on it.
+    task->opts = *opts;
+    task->opts.read_prio = pipeline_resolve_prio(opts->read_prio);
+    task->opts.write_prio = pipeline_resolve_prio(opts->write_prio);
+    snprintf(task->src, sizeof(task->src), "%s", src);
+    snprintf(task->dst, sizeof(task->dst), "%s", dst);
+    task->on_progress = on_progress;
+    task->on_done = on_done;
+    task->user = user;
+    task->start_tick = armGetSystemTick();
+    atomic_init(&task->done, false);
+    atomic_init(&task->data_done, 0);
+    atomic_init(&task->total_size, 0);
+    telemetry_init(&task->telemetry, task->start_tick);
+
+    if (mtx_init(&task->mtx, mtx_plain) != thrd_success)
+    {
+        free(task);
+        return NULL;
+    }
+
+    if (R_FAILED(threadCreate(&task->thread, thrd_copy, task, NULL, 0x10000, COPY_THREAD_PRIO, CORE_DEFAULT)))
+    {
+        mtx_destroy(&task->mtx);
+        free(task);
+        return NULL;
+    }
+
+    if (R_FAILED(threadStart(&task->thread)))
+    {
+        threadClose(&task->thread);
+        mtx_destroy(&task->mtx);
+        free(task);
+        return NULL;
+    }
+
+    return task;
+}
+
+bool copy_poll(copy_task_t *task, size_t *done, size_t *total)
+{
+    if (done) *done = atomic_load(&task->data_done);
+    if (total) *total = atomic_load(&task->total_size);
+    return atomic_load(&task->done);
+}
+
+void copy_cancel(copy_task_t *task)
+{
+    //  If the engine isn't up yet it won't be started, if it has already stopped there's nothing to do.
+    mtx_lock(&task->mtx);
+    task->cancelled = true;
+    if (task->running) copy_engine_cancel(&task->engine);
+    mtx_unlock(&task->mtx);
+}
+
+bool copy_wait(copy_task_t *task)
+{
+    threadWaitForExit(&task->thread);
+    return task->ok;
+}
+
+void copy_free(copy_task_t *task)
+{
+    if (!task) return;
+
+    copy_wait(task);
+    threadClose(&task->thread);
+    copy_engine_exit(&task->engine);
+    mtx_destroy(&task->mtx);
+    free(task);
+}
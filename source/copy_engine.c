@@ -0,0 +1,612 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "copy_engine.h"
+#include "console.h"
+#include "file_io.h"
+#include "hash.h"
+#include "journal.h"
+#include "sparse.h"
+
+
+void copy_opts_default(copy_opts_t *opts)
+{
+    opts->backend = FileBackend_Native;
+    opts->preallocate = true;
+    opts->sparse_block = 0;
+    opts->chunk_size = BUFSIZE;
+    opts->adaptive = true;
+    opts->slot_count = DEFAULT_SLOTS;
+    opts->lane_count = DEFAULT_LANES;
+    opts->split_count = DEFAULT_SPLIT_COUNT;
+    opts->split_threshold = DEFAULT_SPLIT_THRESHOLD;
+    opts->read_core = CORE_AUTO;
+    opts->write_core = CORE_AUTO;
+    opts->hash_core = CORE_AUTO;
+    opts->transform_core = CORE_AUTO;
+    opts->read_prio = PRIO_DEFAULT;
+    opts->write_prio = PRIO_DEFAULT;
+    opts->hash = HashType_None;
+    opts->verify = false;
+    opts->resume = false;
+    opts->transform = TransformType_None;
+    opts->transform_level = DEFAULT_TRANSFORM_LEVEL;
+    opts->transform_workers = DEFAULT_TRANSFORM_WORKERS;
+    opts->read_ahead = 0;
+    opts->pool = NULL;
+    opts->memory_budget = 0;
+    opts->pack_size = DEFAULT_PACK_SIZE;
+    opts->flush = FlushPolicy_End;
+    opts->flush_interval = DEFAULT_FLUSH_INTERVAL;
+    opts->commit = false;
+    opts->dedup_dir = NULL;
+    opts->dedup = NULL;
+    opts->sched = NULL;
+    opts->copy_class = CopyClass_Normal;
+    opts->keep_going = false;
+    opts->on_error = NULL;
+    opts->on_error_user = NULL;
+}
+
+size_t copy_engine_lane_count(const copy_opts_t *opts)
+{
+    //  Ranges of a split file only copy in parallel if there is a lane for each.
+    size_t lane_count = opts->lane_count;
+    if (lane_count < opts->split_count) lane_count = opts->split_count;
+    if (lane_count > MAX_LANES) lane_count = MAX_LANES;
+    return lane_count;
+}
+
+size_t copy_engine_lane_buffers(const copy_opts_t *opts)
+{
+    //  Transformed slots need a spare buffer to write their output to.
+    size_t per_slot = opts->transform != TransformType_None ? 2 : 1;
+    return opts->slot_count * per_slot;
+}
+
+size_t copy_engine_buffers_needed(const copy_opts_t *opts)
+{
+    return copy_engine_lane_count(opts) * copy_engine_lane_buffers(opts);
+}
+
+//  Bytes of one pool buffer for these opts, as the pool rounds it.
+static size_t pool_buffer_bytes(const copy_opts_t *opts)
+{
+    return (pipeline_buffer_size(opts) + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+}
+
+bool copy_engine_fit_budget(copy_opts_t *opts)
+{
+    if (!opts->memory_budget) return true;
+
+    //  The striped groups need a slot for each of their threads.
+    size_t min_slots = BUDGET_MIN_SLOTS;
+    if (opts->transform != TransformType_None && opts->transform_workers > min_slots) min_slots = opts->transform_workers;
+    if (opts->backend == FileBackend_Native && opts->read_ahead > min_slots) min_slots = opts->read_ahead;
+
+    //  Compressed frames are as big as the chunks they were compressed from, so those can't shrink.
+    bool shrink_chunk = opts->transform != TransformType_Decompress;
+
+    copy_opts_t fit = *opts;
+    fit.slot_count = min_slots;
+    for (;;)
+    {
+        size_t lane_bytes = copy_engine_lane_buffers(&fit) * pool_buffer_bytes(&fit);
+        size_t lanes = copy_engine_lane_count(&fit);
+        if (lane_bytes * lanes <= opts->memory_budget) break;
+
+        if (shrink_chunk && fit.chunk_size > BUDGET_MIN_CHUNK) fit.chunk_size >>= 1;
+        else if (lanes > 1)
+        {
+            fit.lane_count = lanes - 1;
+            if (fit.split_count > fit.lane_count) fit.split_count = fit.lane_count;
+        }
+        else return false;
+    }
+
+    //  Whatever is left of the budget goes on more slots.
+    fit.slot_count = 1;
+    size_t slot_bytes = copy_engine_lane_buffers(&fit) * pool_buffer_bytes(&fit);
+    size_t slots = opts->memory_budget / (copy_engine_lane_count(&fit) * slot_bytes);
+    fit.slot_count = slots < MAX_SLOTS ? slots : MAX_SLOTS;
+
+    *opts = fit;
+    return true;
+}
+
+//  The chunk size in the first header of a compressed file, 0 if it isn't one.
+static size_t compressed_chunk(FileBackend backend, const char *path)
+{
+    file_t file;
+    if (!file_open_read(&file, backend, path)) return 0;
+
+    u8 raw[TRANSFORM_HEADER_SIZE];
+    transform_header_t header;
+    bool ok = file_read(&file, raw, sizeof(raw)) == sizeof(raw) && transform_parse_header(raw, &header);
+    file_close(&file);
+    return ok ? header.chunk_size : 0;
+}
+
+size_t copy_engine_compressed_chunk(FileBackend backend, const char *src)
+{
+    //  Compressed input can't be a stream, and opening one to look would use it up.
+    if (file_is_stream(src)) return 0;
+
+    dir_t dir;
+    if (!dir_open(&dir, backend, src)) return compressed_chunk(backend, src);
+
+    size_t chunk = 0;
+    dir_entry_t entry;
+    while (dir_read(&dir, &entry))
+    {
+        char path[FS_MAX_PATH];
+        snprintf(path, sizeof(path), "%s/%s", src, entry.name);
+
+        size_t size = entry.is_dir ? copy_engine_compressed_chunk(backend, path) : compressed_chunk(backend, path);
+        if (size > chunk) chunk = size;
+    }
+
+    dir_close(&dir);
+    return chunk;
+}
+
+//  The first job to fail stops the rest of the copy.
+static void stop_on_error(void *user)
+{
+    copy_engine_t *e = (copy_engine_t *)user;
+    if (!atomic_load(&e->cancelled)) print_console("stopping the copy, a file failed\n\n");
+    copy_engine_cancel(e);
+}
+
+bool copy_engine_start(copy_engine_t *e, const copy_opts_t *opts)
+{
+    if (!e || !opts) return false;
+    e->out_of_buffers = false;
+    if (opts->lane_count == 0 || opts->lane_count > MAX_LANES) return false;
+
+    if (opts->sparse_block && !sparse_block_valid(opts->sparse_block)) return false;
+
+    memset(e, 0, sizeof(copy_engine_t));
+    e->opts = *opts;
+    if (!e->opts.pool && !copy_engine_fit_budget(&e->opts)) return false;
+    atomic_init(&e->cancelled, false);
+    if (e->opts.split_count == 0) e->opts.split_count = 1;
+
+    //  A hash is of the whole file, which can't be done if the ranges are in different lanes.
+    if (e->opts.hash != HashType_None) e->opts.split_count = 1;
+
+    //  The ranges write through one handle with explicit offsets, see split_file_t.
+    if (e->opts.backend != FileBackend_Native) e->opts.split_count = 1;
+
+    //  Transformed output isn't the same size as the input, so ranges can't be written in place,
+    //  and it won't read back with the same hash either.
+    if (e->opts.transform != TransformType_None)
+    {
+        if (!transform_available(e->opts.transform)) return false;
+        e->opts.split_count = 1;
+        e->opts.verify = false;
+    }
+
+    //  Chunks have to line up the same way every time to be found again, and a recipe isn't a copy of the file,
+    //  so it can't be split, packed, resumed, preallocated or verified.
+    if (e->opts.dedup_dir)
+    {
+        if (e->opts.transform != TransformType_None) return false;
+        e->opts.adaptive = false;
+        e->opts.split_count = 1;
+        e->opts.pack_size = 0;
+        e->opts.resume = false;
+        e->opts.verify = false;
+    }
+
+    //  A resumed file only goes through the lane from where it left off,
+    //  so there would be no hash of the start of it, and transformed output can't be resumed into.
+    if (e->opts.hash != HashType_None || e->opts.transform != TransformType_None) e->opts.resume = false;
+
+    e->opts.on_error = e->opts.keep_going ? NULL : stop_on_error;
+    e->opts.on_error_user = e;
+
+    size_t lane_count = copy_engine_lane_count(&e->opts);
+
+    if (!e->opts.pool)
+    {
+        if (!pool_init(&e->own_pool, pipeline_buffer_size(&e->opts), copy_engine_buffers_needed(&e->opts))) return false;
+        e->has_own_pool = true;
+        e->opts.pool = &e->own_pool;
+    }
+
+    if (!job_queue_init(&e->queue))
+    {
+        if (e->has_own_pool) pool_exit(&e->own_pool);
+        return false;
+    }
+
+    if (e->opts.dedup_dir)
+    {
+        if (!dedup_open(&e->store, e->opts.backend, e->opts.dedup_dir))
+        {
+            print_console("failed to open the store in %s\n\n", e->opts.dedup_dir);
+            job_queue_exit(&e->queue);
+            if (e->has_own_pool) pool_exit(&e->own_pool);
+            return false;
+        }
+        e->opts.dedup = &e->store;
+    }
+
+    commit_gate_init(&e->gate);
+    e->opts.commit_gate = e->opts.commit ? &e->gate : NULL;
+
+    e->start_tick = armGetSystemTick();
+    for (size_t i = 0; i < lane_count; i++)
+    {
+        //  The hash and transform threads get the core that the lane's read / write threads aren't on.
+        int cores[Stage_Count];
+        cores[Stage_Read] = opts->read_core == CORE_AUTO ? (int)(i * 2) % CORE_COUNT : opts->read_core;
+        cores[Stage_Fetch] = cores[Stage_Read];
+        cores[Stage_Write] = opts->write_core == CORE_AUTO ? (int)(i * 2 + 1) % CORE_COUNT : opts->write_core;
+        cores[Stage_Hash] = opts->hash_core == CORE_AUTO ? (int)(i * 2 + 2) % CORE_COUNT : opts->hash_core;
+        cores[Stage_Transform] = opts->transform_core == CORE_AUTO ? (int)(i * 2 + 2) % CORE_COUNT : opts->transform_core;
+        if (!pipeline_start(&e->lanes[i], &e->queue, &e->opts, cores))
+        {
+            //  Run with the lanes we managed to start, if any.
+            break;
+        }
+        e->lane_count++;
+    }
+
+    if (e->lane_count == 0)
+    {
+        e->out_of_buffers = e->lanes[0].ring.lease_failed;
+        if (e->opts.dedup) dedup_close(&e->store);
+        job_queue_exit(&e->queue);
+        if (e->has_own_pool) pool_exit(&e->own_pool);
+        return false;
+    }
+
+    return true;
+}
+
+static bool add_job(copy_engine_t *e, const char *src, const char *dst, s64 offset, size_t size,
+    bool create, bool journal, bool pack, split_file_t *split)
+{
+    copy_job_t *job = calloc(1, sizeof(copy_job_t));
+    if (!job) return false;
+
+    snprintf(job->src, sizeof(job->src), "%s", src);
+    snprintf(job->dst, sizeof(job->dst), "%s", dst);
+    job->offset = offset;
+    job->size = size;
+    job->create = create;
+    job->journal = journal;
+    job->pack = pack;
+    job->stream = file_is_stream(src);
+    job->split = split;
+    atomic_init(&job->data_written, 0);
+    atomic_init(&job->result, 0);
+
+    job->list_next = e->jobs;
+    e->jobs = job;
+    e->job_count++;
+
+    job_queue_push(&e->queue, job);
+    return true;
+}
+
+//  Adds the jobs for a file that has already been counted.
+static bool add_counted_file(copy_engine_t *e, const char *src, const char *dst, size_t size)
+{
+    //  A stream can only be written in order, by one lane.
+    size_t split_count = file_is_stream(dst) ? 1 : e->opts.split_count;
+
+    if (split_count <= 1 || size < e->opts.split_threshold)
+    {
+        //  Carrying on from a journal is just copying the rest as a range, written in place.
+        size_t offset = e->opts.resume ? journal_resume_offset(e->opts.backend, src, dst, size) : 0;
+        if (offset)
+        {
+            print_console("resuming %s from %lu MiB\n\n", dst, offset >> 20);
+            e->total_size -= offset;
+            return add_job(e, src, dst, offset, size - offset, false, true, false, NULL);
+        }
+
+        //  A packed file is read and written in one go, so it never needs a journal.
+        //  Transformed files are a frame per slot, so they can't share.
+        bool pack = size <= e->opts.pack_size && size <= pipeline_buffer_size(&e->opts) &&
+            e->opts.transform == TransformType_None;
+        bool journal = e->opts.resume && !pack && !file_is_stream(dst);
+        return add_job(e, src, dst, 0, size, true, journal, pack, NULL);
+    }
+
+    //  Create dst at its final size now, so that every range can be written in place
+    //  no matter which order the lanes get to them. It stays open for the ranges to share.
+    split_file_t *split = calloc(1, sizeof(split_file_t));
+    if (!split) return false;
+    commit_gate_open(e->opts.commit_gate);
+    if (!file_open_write(&split->file, e->opts.backend, dst))
+    {
+        commit_gate_close(e->opts.commit_gate, NULL);
+        free(split);
+        return false;
+    }
+    if (!file_set_size(&split->file, size))
+    {
+        file_close(&split->file);
+        commit_gate_close(e->opts.commit_gate, NULL);
+        free(split);
+        return false;
+    }
+
+    //  Ranges are a whole number of chunks, so that only the last chunk of the file is short.
+    size_t chunk = e->opts.chunk_size;
+    size_t range = (size / split_count + chunk - 1) / chunk * chunk;
+
+    atomic_init(&split->ranges_left, (size + range - 1) / range);
+    split->next = e->splits;
+    e->splits = split;
+
+    bool ok = true;
+    for (size_t offset = 0; offset < size; offset += range)
+    {
+        size_t range_size = size - offset < range ? size - offset : range;
+        ok &= add_job(e, src, dst, offset, range_size, false, false, false, split);
+    }
+    return ok;
+}
+
+//  size is already known, from listing the folder or from copy_engine_add_file.
+//  It is kept in the job, so the reader never has to size the file again.
+static bool add_sized_file(copy_engine_t *e, const char *src, const char *dst, size_t size)
+{
+    if (atomic_load(&e->cancelled)) return false;
+
+    e->file_count++;
+    e->total_size += size;
+
+    //  Without a job there is nothing to fail, so it's counted as failed here.
+    bool ok = add_counted_file(e, src, dst, size);
+    if (!ok) e->add_failed++;
+    return ok;
+}
+
+bool copy_engine_add_file(copy_engine_t *e, const char *src, const char *dst)
+{
+    //  A stream is just read until it ends, as one job. Compressed input needs a size to find the frames.
+    if (file_is_stream(src))
+    {
+        if (atomic_load(&e->cancelled) || e->opts.transform == TransformType_Decompress) return false;
+        e->file_count++;
+        bool ok = add_job(e, src, dst, 0, 0, true, false, false, NULL);
+        if (!ok) e->add_failed++;
+        return ok;
+    }
+
+    return add_sized_file(e, src, dst, get_file_size(e->opts.backend, src));
+}
+
+bool copy_engine_add_dir(copy_engine_t *e, const char *src, const char *dst)
+{
+    //  Every file would go down the one connection, one after another with nothing between them.
+    if (file_is_stream(dst))
+    {
+        print_console("can't copy a folder to %s, a stream is only one file\n\n", dst);
+        return false;
+    }
+
+    dir_t dir;
+    if (!dir_open(&dir, e->opts.backend, src)) return false;
+
+    //  Fine if it already exists, opening the files will fail if it really couldn't be made.
+    mkdir(dst, 0777);
+
+    bool ok = true;
+    dir_entry_t entry;
+    while (dir_read(&dir, &entry))
+    {
+        char src_path[FS_MAX_PATH];
+        char dst_path[FS_MAX_PATH];
+        snprintf(src_path, sizeof(src_path), "%s/%s", src, entry.name);
+        snprintf(dst_path, sizeof(dst_path), "%s/%s", dst, entry.name);
+
+        if (entry.is_dir) ok &= copy_engine_add_dir(e, src_path, dst_path);
+        else ok &= add_sized_file(e, src_path, dst_path, entry.size);
+    }
+
+    dir_close(&dir);
+    return ok;
+}
+
+size_t copy_engine_data_read(copy_engine_t *e)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < e->lane_count; i++)
+    {
+        total += atomic_load(&e->lanes[i].data_read);
+    }
+    return total;
+}
+
+size_t copy_engine_data_written(copy_engine_t *e)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < e->lane_count; i++)
+    {
+        total += atomic_load(&e->lanes[i].data_written);
+    }
+    return total;
+}
+
+size_t copy_engine_data_done(copy_engine_t *e)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < e->lane_count; i++)
+    {
+        total += atomic_load(&e->lanes[i].data_done);
+    }
+    return total;
+}
+
+size_t copy_engine_queue_depth(copy_engine_t *e)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < e->lane_count; i++)
+    {
+        total += ring_depth(&e->lanes[i].ring);
+    }
+    return total;
+}
+
+u64 copy_engine_stall_ticks(copy_engine_t *e)
+{
+    u64 total = 0;
+    for (size_t i = 0; i < e->lane_count; i++)
+    {
+        total += atomic_load(&e->lanes[i].ring.stall_ticks);
+    }
+    return total;
+}
+
+//  Reads back every job that succeeded and compares its hash with the source's.
+static void verify_jobs(copy_engine_t *e)
+{
+    //  Every slot is back in the pool now, so borrow one rather than allocating.
+    void *buf = pool_lease(e->opts.pool);
+    if (!buf) return;
+
+    for (copy_job_t *job = e->jobs; job; job = job->list_next)
+    {
+        //  A stream can't be read back, and a streamed source has no size to read back.
+        if (atomic_load(&job->result) != 0 || job->stream || file_is_stream(job->dst)) continue;
+
+        u8 digest[HASH_MAX_SIZE];
+        bool read = hash_file(e->opts.backend, job->dst, job->offset, job->size, e->opts.hash,
+            buf, e->opts.pool->buffer_size, digest);
+
+        if (!read || memcmp(digest, job->digest, hash_size(e->opts.hash)))
+        {
+            print_console("verify failed for %s\n\n", job->dst);
+            atomic_store(&job->result, -1);
+        }
+        e->verified_count++;
+    }
+
+    pool_return(e->opts.pool, buf);
+}
+
+bool copy_engine_wait(copy_engine_t *e, u64 timeout_ns)
+{
+    job_queue_close(&e->queue);
+    for (size_t i = 0; i < e->lane_count; i++)
+    {
+        if (!pipeline_wait(&e->lanes[i], timeout_ns)) return false;
+    }
+    return true;
+}
+
+void copy_engine_cancel(copy_engine_t *e)
+{
+    //  Closing the queue stops the readers that are waiting for a job.
+    atomic_store(&e->cancelled, true);
+    job_queue_close(&e->queue);
+    for (size_t i = 0; i < e->lane_count; i++)
+    {
+        pipeline_cancel(&e->lanes[i]);
+    }
+}
+
+void copy_engine_finish(copy_engine_t *e)
+{
+    job_queue_close(&e->queue);
+    for (size_t i = 0; i < e->lane_count; i++)
+    {
+        pipeline_join(&e->lanes[i]);
+    }
+    e->elapsed_ticks = armGetSystemTick() - e->start_tick;
+    job_queue_exit(&e->queue);
+
+    //  Anything the writers never finished was cancelled, including jobs left in the queue.
+    for (copy_job_t *job = e->jobs; job; job = job->list_next)
+    {
+        if (!job->finished && atomic_load(&job->result) == 0) atomic_store(&job->result, -1);
+    }
+
+    //  Ranges that never got to their last slot never closed their file.
+    for (split_file_t *split = e->splits; split; split = split->next)
+    {
+        if (atomic_load(&split->ranges_left))
+        {
+            file_close(&split->file);
+            commit_gate_close(e->opts.commit_gate, NULL);
+        }
+        atomic_store(&split->ranges_left, 0);
+    }
+
+    if (e->opts.verify && e->opts.hash != HashType_None) verify_jobs(e);
+
+    if (e->opts.dedup)
+    {
+        dedup_close(&e->store);
+        e->opts.dedup = NULL;
+    }
+
+    if (e->has_own_pool)
+    {
+        pool_exit(&e->own_pool);
+        e->has_own_pool = false;
+    }
+}
+
+void copy_engine_stats(const copy_engine_t *e, stage_stats_t stats[Stage_Count])
+{
+    memset(stats, 0, sizeof(stage_stats_t) * Stage_Count);
+    for (size_t i = 0; i < e->lane_count; i++)
+    {
+        for (size_t s = 0; s < Stage_Count; s++)
+        {
+            pipeline_stage_stats(&e->lanes[i], s, &stats[s]);
+        }
+    }
+}
+
+void copy_engine_print_stats(const copy_engine_t *e)
+{
+    stage_stats_t stats[Stage_Count];
+    copy_engine_stats(e, stats);
+    for (size_t s = 0; s < Stage_Count; s++)
+    {
+        if (e->lane_count && e->lanes[0].has_stage[s]) stats_print(stage_name(s), &stats[s], e->elapsed_ticks);
+    }
+}
+
+size_t copy_engine_failed(const copy_engine_t *e)
+{
+    size_t failed = e->add_failed;
+    for (copy_job_t *job = e->jobs; job; job = job->list_next)
+    {
+        if (atomic_load(&job->result) != 0) failed++;
+    }
+    return failed;
+}
+
+void copy_engine_exit(copy_engine_t *e)
+{
+    copy_job_t *job = e->jobs;
+    while (job)
+    {
+        copy_job_t *next = job->list_next;
+        free(job);
+        job = next;
+    }
+    e->jobs = NULL;
+    e->job_count = 0;
+
+    split_file_t *split = e->splits;
+    while (split)
+    {
+        split_file_t *next = split->next;
+        free(split);
+        split = next;
+    }
+    e->splits = NULL;
+}
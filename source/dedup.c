@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <switch.h>
+
+#include "dedup.h"
+
+
+static size_t slot_of(const dedup_store_t *store, const u8 *digest)
+{
+    //  The digest is already as random as it gets.
+    u64 key;
+    memcpy(&key, digest, sizeof(key));
+    return key & (store->table_size - 1);
+}
+
+//  The entry with this digest, or the empty one it would go in.
+static dedup_entry_t *find(dedup_store_t *store, const u8 *digest)
+{
+    for (size_t i = slot_of(store, digest); ; i = (i + 1) & (store->table_size - 1))
+    {
+        dedup_entry_t *entry = &store->table[i];
+        if (!entry->size || !memcmp(entry->digest, digest, DEDUP_HASH_SIZE)) return entry;
+    }
+}
+
+static bool insert(dedup_store_t *store, const dedup_entry_t *entry)
+{
+    //  Doubles at 3/4 full, so there is always an empty entry for find to stop at.
+    if ((store->entry_count + 1) * 4 > store->table_size * 3)
+    {
+        dedup_entry_t *old = store->table;
+        size_t old_size = store->table_size;
+        dedup_entry_t *table = calloc(old_size * 2, sizeof(dedup_entry_t));
+        if (!table) return false;
+
+        store->table = table;
+        store->table_size = old_size * 2;
+        for (size_t i = 0; i < old_size; i++)
+        {
+            if (old[i].size) *find(store, old[i].digest) = old[i];
+        }
+        free(old);
+    }
+
+    dedup_entry_t *slot = find(store, entry->digest);
+    if (!slot->size) store->entry_count++;
+    *slot = *entry;
+    return true;
+}
+
+//  Loads every whole entry of the index, and cuts off a half written one at the end.
+//  An entry for a chunk that isn't all in the pack was written before the chunk made it to the storage,
+//  so it and everything after it are cut off too, before a new chunk goes where it points.
+static bool load_index(dedup_store_t *store)
+{
+    u32 magic = 0;
+    if (fread(&magic, sizeof(magic), 1, store->index) != 1 || magic != DEDUP_INDEX_MAGIC) return false;
+
+    off_t good = ftello(store->index);
+    dedup_entry_t entry;
+    while (good >= 0 && fread(&entry, sizeof(entry), 1, store->index) == 1)
+    {
+        if (entry.offset > store->pack_size || entry.size > store->pack_size - entry.offset) break;
+        if (entry.size && !insert(store, &entry)) return false;
+        good = ftello(store->index);
+    }
+
+    if (good < 0 || fseeko(store->index, good, SEEK_SET) != 0) return false;
+    return ftruncate(fileno(store->index), good) == 0;
+}
+
+//  Adds the pending entries to the index, once their chunks are flushed to the storage.
+static bool flush_pending(dedup_store_t *store)
+{
+    if (!store->pending_count) return true;
+
+    bool ok = file_flush(&store->pack) &&
+        fwrite(store->pending, sizeof(dedup_entry_t), store->pending_count, store->index) == store->pending_count &&
+        fflush(store->index) == 0;
+    store->pending_count = 0;
+    return ok;
+}
+
+bool dedup_open(dedup_store_t *store, FileBackend backend, const char *dir)
+{
+    if (!store || !dir) return false;
+
+    memset(store, 0, sizeof(dedup_store_t));
+    store->backend = backend;
+    store->table_size = DEDUP_TABLE_MIN;
+    store->table = calloc(store->table_size, sizeof(dedup_entry_t));
+    if (!store->table) return false;
+    if (mtx_init(&store->mtx, mtx_plain) != thrd_success)
+    {
+        free(store->table);
+        return false;
+    }
+
+    //  Failing is fine, it most likely exists already.
+    mkdir(dir, 0777);
+
+    //  Only ever added to, from the end of whatever is there.
+    //  Opened first, as the index is checked against how big it is.
+    char path[FS_MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%s", dir, DEDUP_PACK_NAME);
+    if (!file_open_existing(&store->pack, backend, path) && !file_open_write(&store->pack, backend, path))
+    {
+        dedup_close(store);
+        return false;
+    }
+    store->pack_size = file_get_size(&store->pack);
+
+    snprintf(path, sizeof(path), "%s/%s", dir, DEDUP_INDEX_NAME);
+    store->index = fopen(path, "r+b");
+    if (!store->index)
+    {
+        u32 magic = DEDUP_INDEX_MAGIC;
+        store->index = fopen(path, "w+b");
+        if (store->index && fwrite(&magic, sizeof(magic), 1, store->index) == 1) rewind(store->index);
+    }
+    if (!store->index || !load_index(store))
+    {
+        if (store->index) fclose(store->index);
+        store->index = NULL;
+        file_close(&store->pack);
+        dedup_close(store);
+        return false;
+    }
+
+    return true;
+}
+
+void dedup_close(dedup_store_t *store)
+{
+    if (store->index)
+    {
+        //  The chunks first, so that the index never points at something that isn't there.
+        flush_pending(store);
+        file_close(&store->pack);
+        fclose(store->index);
+    }
+    free(store->table);
+    store->table = NULL;
+    store->index = NULL;
+    mtx_destroy(&store->mtx);
+}
+
+bool dedup_put(dedup_store_t *store, const u8 *digest, const void *data, size_t size, dedup_ref_t *ref, bool *added)
+{
+    mtx_lock(&store->mtx);
+
+    bool ok = true;
+    dedup_entry_t *entry = find(store, digest);
+    *added = !entry->size || entry->size != size;
+    if (*added)
+    {
+        dedup_entry_t new_entry = { .offset = store->pack_size, .size = size };
+        memcpy(new_entry.digest, digest, DEDUP_HASH_SIZE);
+
+        ok = file_seek(&store->pack, store->pack_size) && file_write(&store->pack, data, size) == size &&
+            insert(store, &new_entry);
+        if (ok)
+        {
+            store->pack_size += size;
+            store->pending[store->pending_count++] = new_entry;
+            entry = find(store, digest);
+        }
+        if (ok && store->pending_count == DEDUP_PENDING_MAX) ok = flush_pending(store);
+    }
+
+    if (ok)
+    {
+        ref->offset = entry->offset;
+        ref->size = entry->size;
+        ref->reserved = 0;
+    }
+
+    mtx_unlock(&store->mtx);
+    return ok;
+}
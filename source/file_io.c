@@ -0,0 +1,359 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <switch.h>
+
+#include "file_io.h"
+#include "tcp.h"
+
+
+bool file_is_stream(const char *path)
+{
+    return tcp_is_path(path);
+}
+
+//  Turns a path such as "sdmc:/file" or "file" (relative to the cwd) into the mounted
+//  filesystem and the path inside of it. Returns NULL on error.
+static FsFileSystem *translate_path(const char *path, char *out_path)
+{
+    FsFileSystem *fs = NULL;
+    if (fsdevTranslatePath(path, &fs, out_path) == -1) return NULL;
+    return fs;
+}
+
+bool file_open_read(file_t *f, FileBackend backend, const char *path)
+{
+    if (!f || !path) return false;
+
+    memset(f, 0, sizeof(file_t));
+    f->backend = backend;
+
+    if (tcp_is_path(path))
+    {
+        f->backend = FileBackend_Tcp;
+        return tcp_open(&f->tcp, path);
+    }
+
+    if (backend == FileBackend_Stdio)
+    {
+        f->fp = fopen(path, "rb");
+        return f->fp != NULL;
+    }
+
+    char fs_path[FS_MAX_PATH];
+    FsFileSystem *fs = translate_path(path, fs_path);
+    if (!fs) return false;
+
+    return R_SUCCEEDED(fsFsOpenFile(fs, fs_path, FsOpenMode_Read, &f->file));
+}
+
+bool file_open_write(file_t *f, FileBackend backend, const char *path)
+{
+    if (!f || !path) return false;
+
+    memset(f, 0, sizeof(file_t));
+    f->backend = backend;
+
+    if (tcp_is_path(path))
+    {
+        f->backend = FileBackend_Tcp;
+        return tcp_open(&f->tcp, path);
+    }
+
+    if (backend == FileBackend_Stdio)
+    {
+        f->fp = fopen(path, "wb");
+        return f->fp != NULL;
+    }
+
+    char fs_path[FS_MAX_PATH];
+    FsFileSystem *fs = translate_path(path, fs_path);
+    if (!fs) return false;
+
+    //  There is no truncate on open, so remove any old file first.
+    //  Failing to delete is fine, it most likely didn't exist.
+    fsFsDeleteFile(fs, fs_path);
+    if (R_FAILED(fsFsCreateFile(fs, fs_path, 0, 0))) return false;
+
+    //  Append lets writes past the end grow the file.
+    return R_SUCCEEDED(fsFsOpenFile(fs, fs_path, FsOpenMode_Write | FsOpenMode_Append, &f->file));
+}
+
+bool file_open_existing(file_t *f, FileBackend backend, const char *path)
+{
+    if (!f || !path) return false;
+
+    memset(f, 0, sizeof(file_t));
+    f->backend = backend;
+
+    if (tcp_is_path(path))
+    {
+        f->backend = FileBackend_Tcp;
+        return tcp_open(&f->tcp, path);
+    }
+
+    if (backend == FileBackend_Stdio)
+    {
+        f->fp = fopen(path, "r+b");
+        return f->fp != NULL;
+    }
+
+    char fs_path[FS_MAX_PATH];
+    FsFileSystem *fs = translate_path(path, fs_path);
+    if (!fs) return false;
+
+    return R_SUCCEEDED(fsFsOpenFile(fs, fs_path, FsOpenMode_Write | FsOpenMode_Append, &f->file));
+}
+
+void file_set_cancel(file_t *f, const atomic_bool *cancelled)
+{
+    if (f->backend == FileBackend_Tcp) f->tcp.cancelled = cancelled;
+}
+
+bool file_seek(file_t *f, s64 offset)
+{
+    if (f->backend == FileBackend_Stdio)
+    {
+        return fseeko(f->fp, offset, SEEK_SET) == 0;
+    }
+
+    //  A stream can only "seek" to where it already is.
+    if (f->backend == FileBackend_Tcp) return offset == f->offset;
+
+    f->offset = offset;
+    return true;
+}
+
+s64 file_tell(file_t *f)
+{
+    if (f->backend == FileBackend_Stdio) return ftello(f->fp);
+    return f->offset;
+}
+
+size_t file_read(file_t *f, void *buf, size_t size)
+{
+    if (f->backend == FileBackend_Stdio)
+    {
+        return fread(buf, 1, size, f->fp);
+    }
+
+    if (f->backend == FileBackend_Tcp)
+    {
+        size_t got = tcp_read(&f->tcp, buf, size, &f->failed);
+        f->offset += got;
+        return got;
+    }
+
+    u64 bytes_read = 0;
+    if (R_FAILED(fsFileRead(&f->file, f->offset, buf, size, FsReadOption_None, &bytes_read))) return 0;
+    f->offset += bytes_read;
+    return bytes_read;
+}
+
+size_t file_write(file_t *f, const void *buf, size_t size)
+{
+    if (f->backend == FileBackend_Stdio)
+    {
+        return fwrite(buf, 1, size, f->fp);
+    }
+
+    if (f->backend == FileBackend_Tcp)
+    {
+        size_t sent = tcp_write(&f->tcp, buf, size);
+        f->offset += sent;
+        return sent;
+    }
+
+    if (R_FAILED(fsFileWrite(&f->file, f->offset, buf, size, FsWriteOption_None))) return 0;
+    f->offset += size;
+    return size;
+}
+
+bool file_set_size(file_t *f, s64 size)
+{
+    if (f->backend == FileBackend_Stdio)
+    {
+        //  Flush anything buffered first so it doesn't get written past the new size.
+        if (fflush(f->fp) != 0) return false;
+        return ftruncate(fileno(f->fp), size) == 0;
+    }
+
+    //  Nothing to size on a stream, so nothing to fail.
+    if (f->backend == FileBackend_Tcp) return true;
+
+    return R_SUCCEEDED(fsFileSetSize(&f->file, size));
+}
+
+bool file_flush(file_t *f)
+{
+    if (f->backend == FileBackend_Stdio)
+    {
+        //  fflush only gets it as far as devoptab, fsync is what flushes the fs file.
+        if (fflush(f->fp) != 0) return false;
+        return fsync(fileno(f->fp)) == 0;
+    }
+
+    if (f->backend == FileBackend_Tcp) return true;
+
+    return R_SUCCEEDED(fsFileFlush(&f->file));
+}
+
+bool file_commit(const char *path)
+{
+    if (!path || file_is_stream(path)) return true;
+
+    char fs_path[FS_MAX_PATH];
+    FsFileSystem *fs = translate_path(path, fs_path);
+    if (!fs) return false;
+
+    return R_SUCCEEDED(fsFsCommit(fs));
+}
+
+void file_close(file_t *f)
+{
+    if (f->backend == FileBackend_Stdio)
+    {
+        if (f->fp) fclose(f->fp);
+        f->fp = NULL;
+        return;
+    }
+
+    if (f->backend == FileBackend_Tcp)
+    {
+        tcp_close(&f->tcp);
+        return;
+    }
+
+    fsFileClose(&f->file);
+}
+
+size_t file_get_size(file_t *f)
+{
+    if (f->backend == FileBackend_Stdio)
+    {
+        struct stat st;
+        if (fstat(fileno(f->fp), &st) != 0) return 0;
+        return st.st_size;
+    }
+
+    if (f->backend == FileBackend_Tcp) return 0;
+
+    s64 size = 0;
+    if (R_FAILED(fsFileGetSize(&f->file, &size))) return 0;
+    return size;
+}
+
+size_t get_file_size(FileBackend backend, const char *path)
+{
+    if (!path || file_is_stream(path)) return 0;
+
+    if (backend == FileBackend_Stdio)
+    {
+        struct stat st;
+        if (stat(path, &st) != 0) return 0;
+        return st.st_size;
+    }
+
+    file_t file;
+    if (!file_open_read(&file, backend, path)) return 0;
+    size_t size = file_get_size(&file);
+    file_close(&file);
+    return size;
+}
+
+bool dir_open(dir_t *d, FileBackend backend, const char *path)
+{
+    if (!d || !path || file_is_stream(path)) return false;
+
+    memset(d, 0, sizeof(dir_t));
+    d->backend = backend;
+    d->path = path;
+
+    if (backend == FileBackend_Stdio)
+    {
+        d->dir = opendir(path);
+        return d->dir != NULL;
+    }
+
+    char fs_path[FS_MAX_PATH];
+    FsFileSystem *fs = translate_path(path, fs_path);
+    if (!fs) return false;
+
+    d->entries = malloc(sizeof(FsDirectoryEntry) * DIR_READ_BATCH);
+    if (!d->entries) return false;
+
+    if (R_FAILED(fsFsOpenDirectory(fs, fs_path, FsDirOpenMode_ReadDirs | FsDirOpenMode_ReadFiles, &d->fs_dir)))
+    {
+        free(d->entries);
+        d->entries = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool dir_read(dir_t *d, dir_entry_t *entry)
+{
+    if (d->backend == FileBackend_Stdio)
+    {
+        struct dirent *de;
+        while ((de = readdir(d->dir)))
+        {
+            if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+
+            snprintf(entry->name, sizeof(entry->name), "%s", de->d_name);
+            entry->is_dir = de->d_type == DT_DIR;
+            entry->size = 0;
+            if (!entry->is_dir)
+            {
+                char path[FS_MAX_PATH];
+                snprintf(path, sizeof(path), "%s/%s", d->path, de->d_name);
+                entry->size = get_file_size(FileBackend_Stdio, path);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    //  The fs never returns "." or "..".
+    if (d->next == d->count)
+    {
+        d->next = 0;
+        if (R_FAILED(fsDirRead(&d->fs_dir, &d->count, DIR_READ_BATCH, d->entries)) || d->count <= 0)
+        {
+            d->count = 0;
+            return false;
+        }
+    }
+
+    const FsDirectoryEntry *fs_entry = &d->entries[d->next++];
+    snprintf(entry->name, sizeof(entry->name), "%s", fs_entry->name);
+    entry->is_dir = fs_entry->type == FsDirEntryType_Dir;
+    entry->size = entry->is_dir ? 0 : fs_entry->file_size;
+    return true;
+}
+
+void dir_close(dir_t *d)
+{
+    if (d->backend == FileBackend_Stdio)
+    {
+        if (d->dir) closedir(d->dir);
+        d->dir = NULL;
+        return;
+    }
+
+    fsDirClose(&d->fs_dir);
+    free(d->entries);
+    d->entries = NULL;
+}
+
+const char *file_backend_name(FileBackend backend)
+{
+    switch (backend)
+    {
+        case FileBackend_Stdio:  return "stdio";
+        case FileBackend_Native: return "native";
+        case FileBackend_Tcp:    return "tcp";
+    }
+    return "unknown";
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string.h>
+#include <arm_acle.h>
+#include <switch.h>
+
+#include "hash.h"
+
+
+//  crc is in its final (inverted) form, so 0 is the crc of nothing.
+static u32 crc32_update(u32 crc, const u8 *data, size_t size)
+{
+    crc = ~crc;
+
+    while (size && ((uintptr_t)data & 7))
+    {
+        crc = __crc32b(crc, *data++);
+        size--;
+    }
+
+    //  Slots are page aligned, so nearly everything goes through here.
+    for (; size >= 8; size -= 8, data += 8)
+    {
+        u64 v;
+        memcpy(&v, data, sizeof(v));
+        crc = __crc32d(crc, v);
+    }
+
+    while (size--)
+    {
+        crc = __crc32b(crc, *data++);
+    }
+
+    return ~crc;
+}
+
+void hash_init(hash_ctx_t *ctx, HashType type)
+{
+    ctx->type = type;
+    ctx->crc = 0;
+    if (type == HashType_Sha256) sha256ContextCreate(&ctx->sha);
+}
+
+void hash_update(hash_ctx_t *ctx, const void *data, size_t size)
+{
+    switch (ctx->type)
+    {
+        case HashType_None: break;
+        case HashType_Crc32: ctx->crc = crc32_update(ctx->crc, data, size); break;
+        case HashType_Sha256: sha256ContextUpdate(&ctx->sha, data, size); break;
+    }
+}
+
+void hash_final(hash_ctx_t *ctx, u8 *out)
+{
+    switch (ctx->type)
+    {
+        case HashType_None:
+            break;
+        //  Big endian, so that the hex reads the same as every other crc32 tool.
+        case HashType_Crc32:
+            out[0] = ctx->crc >> 24;
+            out[1] = ctx->crc >> 16;
+            out[2] = ctx->crc >> 8;
+            out[3] = ctx->crc;
+            break;
+        case HashType_Sha256:
+            sha256ContextGetHash(&ctx->sha, out);
+            break;
+    }
+}
+
+size_t hash_size(HashType type)
+{
+    switch (type)
+    {
+        case HashType_None:   return 0;
+        case HashType_Crc32:  return sizeof(u32);
+        case HashType_Sha256: return SHA256_HASH_SIZE;
+    }
+    return 0;
+}
+
+const char *hash_name(HashType type)
+{
+    switch (type)
+    {
+        case HashType_None:   return "none";
+        case HashType_Crc32:  return "crc32";
+        case HashType_Sha256: return "sha256";
+    }
+    return "unknown";
+}
+
+void hash_to_hex(HashType type, const u8 *digest, char *out)
+{
+    size_t size = hash_size(type);
+    for (size_t i = 0; i < size; i++)
+    {
+        sprintf(out + i * 2, "%02x", digest[i]);
+    }
+    out[size * 2] = '\0';
+}
+
+bool hash_file(FileBackend backend, const char *path, s64 offset, size_t size, HashType type,
+    void *buf, size_t buf_size, u8 *out)
+{
+    file_t file;
+    if (!file_open_read(&file, backend, path)) return false;
+    if (offset && !file_seek(&file, offset))
+    {
+        file_close(&file);
+        return false;
+    }
+
+    hash_ctx_t ctx;
+    hash_init(&ctx, type);
+
+    bool ok = true;
+    for (size_t done = 0; ok && done < size; )
+    {
+        size_t chunk = size - done < buf_size ? size - done : buf_size;
+        size_t read = file_read(&file, buf, chunk);
+        hash_update(&ctx, buf, read);
+        ok = read == chunk;
+        done += read;
+    }
+
+    file_close(&file);
+    hash_final(&ctx, out);
+    return ok;
+}
@@ -0,0 +1,77 @@
+#include <string.h>
+
+#include "job.h"
+
+
+bool job_queue_init(job_queue_t *q)
+{
+    if (!q) return false;
+
+    memset(q, 0, sizeof(job_queue_t));
+    if (mtx_init(&q->mtx, mtx_plain) != thrd_success) return false;
+    if (cnd_init(&q->can_pop) != thrd_success) return false;
+    return true;
+}
+
+void job_queue_exit(job_queue_t *q)
+{
+    cnd_destroy(&q->can_pop);
+    mtx_destroy(&q->mtx);
+}
+
+void job_queue_push(job_queue_t *q, copy_job_t *job)
+{
+    job->next = NULL;
+
+    mtx_lock(&q->mtx);
+    if (q->tail) q->tail->next = job;
+    else q->head = job;
+    q->tail = job;
+    cnd_signal(&q->can_pop);
+    mtx_unlock(&q->mtx);
+}
+
+copy_job_t *job_queue_pop(job_queue_t *q)
+{
+    mtx_lock(&q->mtx);
+    while (!q->head && !q->closed)
+    {
+        cnd_wait(&q->can_pop, &q->mtx);
+    }
+
+    copy_job_t *job = q->head;
+    if (job)
+    {
+        q->head = job->next;
+        if (!q->head) q->tail = NULL;
+    }
+    mtx_unlock(&q->mtx);
+
+    return job;
+}
+
+copy_job_t *job_queue_pop_packable(job_queue_t *q, size_t max_size)
+{
+    mtx_lock(&q->mtx);
+    copy_job_t *job = q->head;
+    if (job && job->pack && job->size <= max_size)
+    {
+        q->head = job->next;
+        if (!q->head) q->tail = NULL;
+    }
+    else
+    {
+        job = NULL;
+    }
+    mtx_unlock(&q->mtx);
+
+    return job;
+}
+
+void job_queue_close(job_queue_t *q)
+{
+    mtx_lock(&q->mtx);
+    q->closed = true;
+    cnd_broadcast(&q->can_pop);
+    mtx_unlock(&q->mtx);
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <switch.h>
+
+#include "journal.h"
+#include "hash.h"
+
+
+static void journal_path(char *out, size_t size, const char *dst)
+{
+    snprintf(out, size, "%s%s", dst, JOURNAL_EXT);
+}
+
+//  The journal is tiny and written rarely, so plain stdio is fine.
+bool journal_save(const char *dst, const journal_t *journal)
+{
+    char path[FS_MAX_PATH];
+    journal_path(path, sizeof(path), dst);
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+
+    bool ok = fwrite(journal, sizeof(journal_t), 1, fp) == 1;
+    ok &= fclose(fp) == 0;
+    return ok;
+}
+
+void journal_remove(const char *dst)
+{
+    char path[FS_MAX_PATH];
+    journal_path(path, sizeof(path), dst);
+    remove(path);
+}
+
+static bool journal_load(const char *dst, journal_t *journal)
+{
+    char path[FS_MAX_PATH];
+    journal_path(path, sizeof(path), dst);
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+
+    bool ok = fread(journal, sizeof(journal_t), 1, fp) == 1;
+    fclose(fp);
+    return ok && journal->magic == JOURNAL_MAGIC;
+}
+
+//  The crc of the tail in path, in the same form as the journal has it.
+static bool tail_crc(FileBackend backend, const char *path, const journal_t *journal, void *buf, u32 *out)
+{
+    u8 digest[HASH_MAX_SIZE];
+    if (!hash_file(backend, path, journal->offset - journal->tail_size, journal->tail_size, HashType_Crc32,
+        buf, JOURNAL_TAIL_SIZE, digest))
+    {
+        return false;
+    }
+
+    *out = (digest[0] << 24) | (digest[1] << 16) | (digest[2] << 8) | digest[3];
+    return true;
+}
+
+size_t journal_resume_offset(FileBackend backend, const char *src, const char *dst, size_t src_size)
+{
+    journal_t journal;
+    if (!journal_load(dst, &journal)) return 0;
+
+    //  A journal that doesn't make sense for this file, or a file that has changed since, means starting over.
+    if (journal.file_size != src_size || journal.offset >= src_size) return 0;
+    if (journal.tail_size > JOURNAL_TAIL_SIZE || journal.tail_size > journal.offset) return 0;
+    if (get_file_size(backend, dst) < journal.offset) return 0;
+
+    void *buf = malloc(JOURNAL_TAIL_SIZE);
+    if (!buf) return 0;
+
+    u32 src_crc = 0, dst_crc = 0;
+    bool ok = tail_crc(backend, src, &journal, buf, &src_crc) && tail_crc(backend, dst, &journal, buf, &dst_crc);
+    free(buf);
+
+    if (!ok || src_crc != journal.tail_crc || dst_crc != journal.tail_crc) return 0;
+    return journal.offset;
+}
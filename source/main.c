@@ -17,218 +17,388 @@
 *   Then we will unclock the mutex once we are done using it in that thread.
 *
 *   In general, the data shared between threads always needs to be protected. 
+*
+*   The example has since grown into a small copy engine:
+*       ring.c          - the lock free ring of buffers shared by a read / write pair.
+*       sync.c          - spinning for a moment before going to sleep on the ring.
+*       pipeline.c      - the read / write threads (a "lane"), and the fetch threads reading ahead.
+*       copy_engine.c   - a queue of jobs served by a pool of lanes, for copying whole folders.
+*       buffer_pool.c   - every slot buffer, allocated once.
+*       file_io.c       - stdio and native fs file access.
+*       tcp.c           - a socket as the source or destination of a copy.
+*       bench.c         - benchmarks run on the console.
+*       mem.c           - NEON copy / compare of slot sized buffers.
+*       copy.c          - a copy running in the background, with progress and cancel.
+*       progress.c      - the only thing that prints during a copy, a line or a graph.
+*       telemetry.c     - a sample of the copy every second, for the graph and for looking back at.
+*       sparse.c        - finds the zero blocks of a chunk, which the writer can skip.
+*       dedup.c         - a store of chunks by hash, for backups of files that barely change.
+*       scheduler.c     - shares the storage between copies running at the same time, by class.
+*       stats.c         - timings of each stage, printed once the copy is done.
+*       hash.c          - crc32 / sha256 of each file, worked out by a third thread in the lane.
+*       journal.c       - how far each file has got, so an interrupted copy can carry on.
+*       transform.c     - zstd compress / decompress of each chunk, by a few more threads in the lane.
 */
 
 #include <stdio.h>
-#include <stdint.h>
-#include <stdbool.h>
-#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
 #include <switch.h>
-#include <threads.h>
+
+#include "bench.h"
+#include "console.h"
+#include "copy.h"
+#include "copy_engine.h"
+#include "file_io.h"
+#include "hash.h"
+#include "progress.h"
+#include "transform.h"
 
 
 /*
-*   I have defined the input file and the output file.
-*   Also defined the buffer size, which is 8MiB.
+*   I have defined the default input file and the output file.
+*   Both can be overridden on the command line, and either can be a folder.
 */
 #define INFILE  "infile"
 #define OUTFILE "outfile"
-#define BUFSIZE 0x800000
 
-typedef struct
-{
-    void *data;
-    size_t data_size;
-    size_t data_written;
-    size_t total_size;
-} thread_t;
 
-/*
-*   We create 2 mutex's that will be locked.
-*   The file mtx is for the read / write functions.
-*   The console mtx is for when we want to write to stdout and update the console.  
-*/
-mtx_t file_mtx;
-mtx_t console_mtx;
+//  Sockets are only started when one end of the copy is over tcp.
+static bool net_started = false;
 
-/*
-*   Our conditional vars.
-*/
-cnd_t can_write;
-cnd_t can_read;
-
-
-//  Gets the file size. Returns 0 on error.
-size_t get_file_size(const char *file)
+bool init_app(void)
 {
-    if (!file) return 0;
-
-    FILE *fp = fopen(file, "rb");
-    if (!fp) return 0;
-
-    fseek(fp, 0, SEEK_END);
-    size_t size = ftell(fp);
-    fclose(fp);
-    return size;
+    if (!console_init()) return false;
+    return true;
 }
 
-//  Thread safe console update function.
-void print_console(const char *text, ...)
+bool init_net(void)
 {
-    mtx_lock(&console_mtx);
+    if (R_FAILED(socketInitializeDefault())) return false;
+    net_started = true;
 
-    va_list v;
-    va_start(v, text);
-    vfprintf(stdout, text, v);
-    va_end(v);
-    consoleUpdate(NULL);
+    struct in_addr ip = { .s_addr = gethostid() };
+    print_console("console ip is %s\n\n", inet_ntoa(ip));
+    return true;
+}
 
-    mtx_unlock(&console_mtx);
+void exit_app(void)
+{
+    if (net_started) socketExit();
+    console_exit();
 }
 
-//  The read thread function.
-int thrd_read(void *in)
+//  Keeps the console up until + is pressed, so that results can be read.
+void wait_for_exit(void)
 {
-    print_console("inside read function\n\n");
+    print_console("press + to exit\n");
 
-    thread_t *t = (thread_t *)in;
-    if(!t) return -1;
+    padConfigureInput(1, HidNpadStyleSet_NpadStandard);
+    PadState pad;
+    padInitializeDefault(&pad);
 
-    FILE *fp = fopen(INFILE, "rb");
-    if (!fp) return -1;
+    while (appletMainLoop())
+    {
+        padUpdate(&pad);
+        if (padGetButtonsDown(&pad) & HidNpadButton_Plus) break;
+        svcSleepThread(16666666);
+    }
+}
 
-    void *buf = malloc(BUFSIZE);
+//  A line for each file, the same as sha256sum would print, in the order the files were added.
+void print_digests(const copy_engine_t *e, HashType hash)
+{
+    const copy_job_t **jobs = malloc(e->job_count * sizeof(copy_job_t *));
+    if (!jobs)
+    {
+        print_console("not enough memory to list the %s of every file\n\n", hash_name(hash));
+        return;
+    }
 
-    for (uint64_t done = 0, bufsize = BUFSIZE; done < t->total_size; done += bufsize)
+    size_t count = e->job_count;
+    for (const copy_job_t *job = e->jobs; job; job = job->list_next)
     {
-        if (done + bufsize > t->total_size)
-            bufsize = t->total_size - done;
+        jobs[--count] = job;
+    }
 
+    print_console("%s:\n", hash_name(hash));
+    for (size_t i = 0; i < e->job_count; i++)
+    {
+        char hex[HASH_MAX_SIZE * 2 + 1];
+        if (atomic_load(&jobs[i]->result) == 0) hash_to_hex(hash, jobs[i]->digest, hex);
+        else snprintf(hex, sizeof(hex), "failed");
+        print_console("%s  %s\n", hex, jobs[i]->src);
+    }
+    print_console("\n");
+    free(jobs);
+}
 
-        print_console("reading into buffer\n\n");
-        fread(buf, bufsize, 1, fp);
+int main(int argc, char *argv[])
+{
+    if (!init_app())
+    {
+        goto jmp_exit;
+    }
 
-        print_console("locking mutex in read\n\n");
-        mtx_lock(&file_mtx);
-        print_console("locked mutex in read\n\n");
-        if (t->data_size != 0)
+    //  Native fs access is the default, pass "--stdio" to go through stdio instead.
+    copy_opts_t opts;
+    copy_opts_default(&opts);
+    const char *src = INFILE;
+    const char *dst = OUTFILE;
+    size_t bench_split_mb = 0;
+    size_t bench_sweep_mb = 0;
+    size_t bench_mem_mb = 0;
+    size_t bench_handoff_count = 0;
+    size_t bench_sched_mb = 0;
+    const char *bg_src = NULL;
+    const char *bg_dst = NULL;
+    bool graph = true;
+    bool fixed_chunk = false;
+    bool adaptive = false;
+    const char *telemetry_path = NULL;
+
+    for (int i = 1, positional = 0; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--stdio")) opts.backend = FileBackend_Stdio;
+        else if (!strcmp(argv[i], "--native")) opts.backend = FileBackend_Native;
+        else if (!strcmp(argv[i], "--no-prealloc")) opts.preallocate = false;
+        else if (!strcmp(argv[i], "--sparse") && i + 1 < argc) opts.sparse_block = strtoul(argv[++i], NULL, 0) << 10;
+        else if (!strcmp(argv[i], "--slots") && i + 1 < argc) opts.slot_count = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--budget") && i + 1 < argc) opts.memory_budget = strtoul(argv[++i], NULL, 0) << 20;
+        else if (!strcmp(argv[i], "--lanes") && i + 1 < argc) opts.lane_count = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--split") && i + 1 < argc) opts.split_count = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--read-core") && i + 1 < argc) opts.read_core = strtol(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--write-core") && i + 1 < argc) opts.write_core = strtol(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--read-prio") && i + 1 < argc) opts.read_prio = strtol(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--write-prio") && i + 1 < argc) opts.write_prio = strtol(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--chunk") && i + 1 < argc)
+        {
+            size_t kib = strtoul(argv[++i], NULL, 0);
+            if (kib == 0 || kib > MAX_BUFSIZE >> 10)
+            {
+                print_console("--chunk must be 1 to %d KiB\n\n", MAX_BUFSIZE >> 10);
+                wait_for_exit();
+                goto jmp_exit;
+            }
+            opts.chunk_size = kib << 10;
+            fixed_chunk = true;
+        }
+        else if (!strcmp(argv[i], "--adaptive")) adaptive = true;
+        else if (!strcmp(argv[i], "--hash") && i + 1 < argc)
+        {
+            i++;
+            if (!strcmp(argv[i], "crc32")) opts.hash = HashType_Crc32;
+            else if (!strcmp(argv[i], "sha256")) opts.hash = HashType_Sha256;
+        }
+        else if (!strcmp(argv[i], "--verify")) opts.verify = true;
+        else if (!strcmp(argv[i], "--resume")) opts.resume = true;
+        else if (!strcmp(argv[i], "--flush") && i + 1 < argc)
+        {
+            i++;
+            if (!strcmp(argv[i], "end")) opts.flush = FlushPolicy_End;
+            else if (!strcmp(argv[i], "chunk")) opts.flush = FlushPolicy_Chunk;
+            else opts.flush = FlushPolicy_Interval, opts.flush_interval = strtoul(argv[i], NULL, 0) << 20;
+        }
+        else if (!strcmp(argv[i], "--commit")) opts.commit = true;
+        else if (!strcmp(argv[i], "--keep-going")) opts.keep_going = true;
+        else if (!strcmp(argv[i], "--class") && i + 1 < argc)
         {
-            print_console("waiting for can read cond\n\n");
-            cnd_wait(&can_read, &file_mtx);
-            print_console("got can read cond\n\n");
+            i++;
+            if (!strcmp(argv[i], "interactive")) opts.copy_class = CopyClass_Interactive;
+            else if (!strcmp(argv[i], "normal")) opts.copy_class = CopyClass_Normal;
+            else if (!strcmp(argv[i], "bulk")) opts.copy_class = CopyClass_Bulk;
         }
+        else if (!strcmp(argv[i], "--background") && i + 2 < argc) bg_src = argv[++i], bg_dst = argv[++i];
+        else if (!strcmp(argv[i], "--pack") && i + 1 < argc) opts.pack_size = strtoul(argv[++i], NULL, 0) << 10;
+        else if (!strcmp(argv[i], "--dedup") && i + 1 < argc) opts.dedup_dir = argv[++i];
+        else if (!strcmp(argv[i], "--compress")) opts.transform = TransformType_Compress;
+        else if (!strcmp(argv[i], "--decompress")) opts.transform = TransformType_Decompress;
+        else if (!strcmp(argv[i], "--level") && i + 1 < argc) opts.transform_level = strtol(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--read-ahead") && i + 1 < argc) opts.read_ahead = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--workers") && i + 1 < argc) opts.transform_workers = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--no-graph")) graph = false;
+        else if (!strcmp(argv[i], "--telemetry") && i + 1 < argc) telemetry_path = argv[++i];
+        else if (!strcmp(argv[i], "--bench") && i + 1 < argc) bench_sweep_mb = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--bench-split") && i + 1 < argc) bench_split_mb = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--bench-mem") && i + 1 < argc) bench_mem_mb = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--bench-handoff") && i + 1 < argc) bench_handoff_count = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--bench-sched") && i + 1 < argc) bench_sched_mb = strtoul(argv[++i], NULL, 0);
+        else if (positional == 0) src = argv[i], positional++;
+        else if (positional == 1) dst = argv[i], positional++;
+    }
 
-        print_console("copying data in read\n\n");
-        memcpy(t->data, buf, bufsize);
-        t->data_size = bufsize;
+    //  A chunk size is fixed unless --adaptive says otherwise, wherever it is on the command line.
+    if (fixed_chunk) opts.adaptive = adaptive;
 
-        mtx_unlock(&file_mtx);
-        cnd_signal(&can_write);
-        print_console("unlocked read mutex and sent can write cond\n\n");
+    //  Decompressing needs slots as big as the chunks the files were compressed in, whatever --chunk says.
+    if (opts.transform == TransformType_Decompress)
+    {
+        size_t chunk = copy_engine_compressed_chunk(opts.backend, src);
+        if (chunk > opts.chunk_size && chunk <= MAX_BUFSIZE) opts.chunk_size = chunk;
     }
 
-    print_console("exiting read thread\n\n");
-    free(buf);
-    fclose(fp);
-    return 0;
-}
+    //  The applet heap is small, so don't let the slots take all of it.
+    if (!opts.memory_budget && appletGetAppletType() != AppletType_Application) opts.memory_budget = DEFAULT_APPLET_BUDGET;
+    //  A background copy has slots of its own out of the same budget.
+    if (bg_src) opts.memory_budget /= 2;
+    if (!copy_engine_fit_budget(&opts))
+    {
+        print_console("%lu KiB isn't enough memory for a lane\n\n", opts.memory_budget >> 10);
+        wait_for_exit();
+        goto jmp_exit;
+    }
 
-//  The write thread function.
-int thrd_write(void *in)
-{
-    print_console("inside write function\n\n");
+    print_console("using %s file backend, %lu lanes of %lu x %lu KiB slots\n\n",
+        file_backend_name(opts.backend), opts.lane_count, opts.slot_count, opts.chunk_size >> 10);
 
-    thread_t *t = (thread_t *)in;
-    if (!t) return 1;
+    if (bench_split_mb || bench_sweep_mb || bench_mem_mb || bench_handoff_count || bench_sched_mb)
+    {
+        if (bench_split_mb) bench_split(&opts, bench_split_mb << 20);
+        if (bench_sweep_mb) bench_sweep(&opts, bench_sweep_mb << 20);
+        if (bench_mem_mb) bench_mem(bench_mem_mb << 20);
+        if (bench_handoff_count) bench_handoff(bench_handoff_count);
+        if (bench_sched_mb) bench_sched(&opts, bench_sched_mb << 20);
+        wait_for_exit();
+        goto jmp_exit;
+    }
+
+    if (!transform_available(opts.transform))
+    {
+        print_console("%s needs a build with USE_ZSTD=1\n\n", transform_name(opts.transform));
+        wait_for_exit();
+        goto jmp_exit;
+    }
+    if (opts.transform != TransformType_None && opts.verify)
+    {
+        print_console("can't verify a %s, skipping verify\n\n", transform_name(opts.transform));
+        opts.verify = false;
+    }
+
+    //  Verifying needs the hash of the source, so crc32 if no hash was asked for.
+    if (opts.verify && opts.hash == HashType_None) opts.hash = HashType_Crc32;
 
-    FILE *fp = fopen(OUTFILE, "wb");
-    if (!fp) return -1;
+    bool streams = file_is_stream(src) || file_is_stream(dst) ||
+        (bg_src && (file_is_stream(bg_src) || file_is_stream(bg_dst)));
+    if (streams && !init_net())
+    {
+        print_console("failed to start sockets\n\n");
+        wait_for_exit();
+        goto jmp_exit;
+    }
 
-    while (t->data_written < t->total_size)
+    //  Every slot the copy (and the background one) will use, set up once.
+    size_t buffers = copy_engine_buffers_needed(&opts) * (bg_src ? 2 : 1);
+    buffer_pool_t pool;
+    if (!pool_init(&pool, pipeline_buffer_size(&opts), buffers))
     {
-        print_console("locking write mutex\n\n");
-        mtx_lock(&file_mtx);
-        print_console("locked write mutex\n\n");
+        print_console("failed to allocate %lu buffers\n\n", buffers);
+        goto jmp_exit;
+    }
+    opts.pool = &pool;
 
-        if (t->data_size == 0)
+    //  A background copy runs as bulk, sharing the storage with the copy by class.
+    sched_t sched;
+    copy_task_t *bg_task = NULL;
+    if (bg_src)
+    {
+        if (!sched_init(&sched))
         {
-            print_console("waiting for can write cond\n\n");
-            cnd_wait(&can_write, &file_mtx);
-            print_console("got can write cond\n\n");
+            print_console("failed to start the scheduler\n\n");
+            pool_exit(&pool);
+            goto jmp_exit;
         }
+        opts.sched = &sched;
 
-        print_console("writing data to file %lu\n\n", t->data_size);
-        fwrite(t->data, t->data_size, 1, fp);
-        t->data_written += t->data_size;
-        t->data_size = 0;
-        print_console("currently written %lu - %lu\n\n", t->data_written, t->total_size);
+        copy_opts_t bg_opts = opts;
+        bg_opts.copy_class = CopyClass_Bulk;
+        bg_task = copy_start(bg_src, bg_dst, &bg_opts, NULL, NULL, NULL);
+        if (!bg_task) print_console("failed to start the background copy\n\n");
+        else print_console("copying %s to %s in the background\n\n", bg_src, bg_dst);
+    }
 
-        mtx_unlock(&file_mtx);
-        cnd_signal(&can_read);
-        print_console("unlocked write mutex and sent can read cond\n\n");
+    copy_task_t *task = copy_start(src, dst, &opts, graph ? NULL : progress_print, NULL, NULL);
+    if (!task)
+    {
+        print_console("failed to start the copy\n\n");
+        if (bg_task)
+        {
+            copy_cancel(bg_task);
+            copy_free(bg_task);
+        }
+        if (bg_src) sched_exit(&sched);
+        pool_exit(&pool);
+        goto jmp_exit;
     }
 
-    print_console("exiting write thread\n\n");
-    fclose(fp);
-    return 0;
-}
+    //  The copy runs on threads of its own, so this one is free to keep reading input.
+    print_console("copying %s to %s as %s, press B to cancel\n\n", src, dst, copy_class_name(opts.copy_class));
+    padConfigureInput(1, HidNpadStyleSet_NpadStandard);
+    PadState pad;
+    padInitializeDefault(&pad);
 
-bool init_app(void)
-{
-    if (!consoleInit(NULL)) return false;
-    if (!mtx_init(&file_mtx, mtx_plain)) return false;
-    if (!mtx_init(&console_mtx, mtx_plain)) return false;
-    if (!cnd_init(&can_read)) return false;
-    if (!cnd_init(&can_write)) return false;
-    return true;
-}
+    //  The graph is redrawn whenever there's a new sample, so about once a second.
+    size_t drawn = 0;
+    size_t done = 0, total = 0;
+    for (bool finished = false; !finished; )
+    {
+        finished = copy_poll(task, &done, &total);
+        size_t samples = telemetry_count(&task->telemetry);
+        if (graph && samples != drawn)
+        {
+            progress_graph(&task->telemetry, done, total, drawn != 0);
+            drawn = samples;
+        }
+        //  Only done once the background copy is too.
+        if (bg_task) finished = copy_poll(bg_task, NULL, NULL) && finished;
+        if (finished) break;
 
-void exit_app(void)
-{
-    consoleExit(NULL);
-    cnd_destroy(&can_read);
-    cnd_destroy(&can_write);
-    mtx_destroy(&file_mtx);
-    mtx_destroy(&console_mtx);
-}
+        padUpdate(&pad);
+        if (padGetButtonsDown(&pad) & HidNpadButton_B)
+        {
+            copy_cancel(task);
+            if (bg_task) copy_cancel(bg_task);
+        }
+        svcSleepThread(16666666);
+    }
+    copy_wait(task);
+    print_console("\n\n");
 
-int main(int argc, char *argv[])
-{
-    if (!init_app())
+    if (bg_task)
     {
-        goto jmp_exit;
+        copy_wait(bg_task);
+        copy_engine_t *bg = &bg_task->engine;
+        print_console("background copy of %s, %lu files (%lu bytes), %lu failed%s\n\n", bg_src,
+            bg->file_count, bg->total_size, copy_engine_failed(bg), bg_task->added ? "" : ", some files couldn't be added");
+        copy_free(bg_task);
     }
 
-    print_console("getting file size\n\n");
-    size_t file_size = get_file_size(INFILE);
-    if (!file_size)
+    copy_engine_t *engine = &task->engine;
+    if (!task->added)
     {
-        goto jmp_exit;
+        print_console("failed to add some files from %s\n\n", src);
     }
-    print_console("got file size\n\n");
-
-    print_console("setting up struct %s", "test\n\n");
-    thread_t thread_struct;
-    thread_struct.data = malloc(BUFSIZE);
-    thread_struct.data_size = 0;
-    thread_struct.data_written = 0;
-    thread_struct.total_size = file_size;
-
-    thrd_t t_read;
-    thrd_t t_write;
 
-    print_console("creating threads\n\n");
-    thrd_create(&t_read, thrd_read, &thread_struct);
-    thrd_create(&t_write, thrd_write, &thread_struct);
-
-    print_console("waiting for threads to join\n\n");
-    thrd_join(t_read, NULL);
-    thrd_join(t_write, NULL);
-    free(thread_struct.data);
+    print_console("done, %lu files (%lu bytes), written %lu bytes, %lu failed\n\n",
+        engine->file_count, engine->total_size, copy_engine_data_written(engine), copy_engine_failed(engine));
+    if (opts.hash != HashType_None) print_digests(engine, opts.hash);
+    if (opts.verify)
+    {
+        print_console("verified %lu files\n\n", engine->verified_count);
+    }
+    copy_engine_print_stats(engine);
+    if (telemetry_path)
+    {
+        if (telemetry_export(&task->telemetry, telemetry_path)) print_console("\ntelemetry written to %s\n\n", telemetry_path);
+        else print_console("\nfailed to write telemetry to %s\n\n", telemetry_path);
+    }
+    copy_free(task);
+    if (bg_src) sched_exit(&sched);
+    pool_exit(&pool);
+    wait_for_exit();
 
     jmp_exit:
     exit_app();
     return 0;
-}
\ No newline at end of file
+}
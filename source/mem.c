@@ -0,0 +1,66 @@
+#include <arm_neon.h>
+#include <switch.h>
+
+#include "mem.h"
+
+
+void mem_copy(void *dst, const void *src, size_t size)
+{
+    u8 *d = (u8 *)dst;
+    const u8 *s = (const u8 *)src;
+
+    //  All four loads go out before any store, so the store of one doesn't wait on the next load.
+    for (; size >= 64; d += 64, s += 64, size -= 64)
+    {
+        uint8x16_t q0 = vld1q_u8(s);
+        uint8x16_t q1 = vld1q_u8(s + 16);
+        uint8x16_t q2 = vld1q_u8(s + 32);
+        uint8x16_t q3 = vld1q_u8(s + 48);
+        vst1q_u8(d, q0);
+        vst1q_u8(d + 16, q1);
+        vst1q_u8(d + 32, q2);
+        vst1q_u8(d + 48, q3);
+    }
+
+    for (; size >= 16; d += 16, s += 16, size -= 16)
+    {
+        vst1q_u8(d, vld1q_u8(s));
+    }
+
+    while (size--)
+    {
+        *d++ = *s++;
+    }
+}
+
+bool mem_equal(const void *a, const void *b, size_t size)
+{
+    const u8 *x = (const u8 *)a;
+    const u8 *y = (const u8 *)b;
+
+    //  Or the differences of 256 bytes together, then look once.
+    while (size >= 256)
+    {
+        uint8x16_t diff = veorq_u8(vld1q_u8(x), vld1q_u8(y));
+        for (size_t i = 16; i < 256; i += 16)
+        {
+            diff = vorrq_u8(diff, veorq_u8(vld1q_u8(x + i), vld1q_u8(y + i)));
+        }
+        if (vmaxvq_u8(diff)) return false;
+        x += 256;
+        y += 256;
+        size -= 256;
+    }
+
+    for (; size >= 16; x += 16, y += 16, size -= 16)
+    {
+        if (vmaxvq_u8(veorq_u8(vld1q_u8(x), vld1q_u8(y)))) return false;
+    }
+
+    while (size--)
+    {
+        if (*x++ != *y++) return false;
+    }
+
+    return true;
+}
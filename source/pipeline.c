@@ -0,0 +1,1002 @@
+#include <string.h>
+#include <switch.h>
+
+#include "pipeline.h"
+#include "console.h"
+#include "journal.h"
+#include "sparse.h"
+#include "trace.h"
+
+
+//  Stack for each thread, only print_console needs more than a little.
+#define THREAD_STACK_SIZE 0x10000
+
+
+//  Sends the end of stream slots, after which every other thread exits.
+//  Each thread of a group only sees every nth slot, so there are enough for all of them.
+static void send_end_of_stream(thread_t *t)
+{
+    for (size_t i = 0; i < t->eos_count; i++)
+    {
+        slot_t *slot = ring_claim(&t->ring);
+        if (!slot) return;
+        slot->job = NULL;
+        slot->eof = true;
+        slot->error = false;
+        slot->pack_count = 0;
+        slot->fetch = false;
+        slot->read_ticks = 0;
+        slot->size = 0;
+        slot->src_size = 0;
+        ring_push(&t->ring);
+    }
+}
+
+//  Fails a job, and unless told to keep going the whole copy with it,
+//  so that every thread and buffer is let go of straight away.
+static void fail_job(thread_t *t, copy_job_t *job)
+{
+    atomic_store(&job->result, -1);
+    if (t->opts.on_error) t->opts.on_error(t->opts.on_error_user);
+}
+
+//  The number of end of stream slots a thread sees before it exits.
+static size_t eos_needed(const thread_t *t, size_t stage)
+{
+    return t->eos_count / t->ring.group_size[t->ring.group_of[stage]];
+}
+
+static const char *stage_names[Stage_Count] = { "read", "fetch", "hash", "transform", "write" };
+
+const char *stage_name(Stage stage)
+{
+    return stage_names[stage];
+}
+
+//  Compressed input is read a frame at a time, see transform.h.
+//  Reads the header of the next frame and returns the frame size, 0 at the end or on error.
+static size_t read_frame_header(thread_t *t, file_t *file, copy_job_t *job, size_t *done, bool *error)
+{
+    if (*done >= job->size) return 0;
+
+    u8 raw[TRANSFORM_HEADER_SIZE];
+    transform_header_t header;
+    bool ok = file_read(file, raw, sizeof(raw)) == sizeof(raw) && transform_parse_header(raw, &header);
+    if (!ok || *done + sizeof(raw) + header.frame_size > job->size)
+    {
+        print_console("%s is not a file compressed by this\n\n", job->src);
+        *error = true;
+        *done = job->size;
+        return 0;
+    }
+
+    //  Both the frame and what it decompresses to have to fit in a slot.
+    size_t cap = t->ring.pool->buffer_size;
+    if (header.frame_size > cap || header.content_size > cap)
+    {
+        print_console("%s was compressed in %lu KiB chunks, the slots are too small for it\n\n",
+            job->src, header.chunk_size >> 10);
+        *error = true;
+        *done = job->size;
+        return 0;
+    }
+
+    *done += sizeof(raw);
+    return header.frame_size;
+}
+
+//  Takes a turn at the storage from the scheduler, if there is one, fill if it's to read into a slot.
+//  Returns when the turn started, for pay_turn.
+static u64 take_turn(thread_t *t, stage_stats_t *stats, bool fill)
+{
+    if (t->opts.sched)
+    {
+        stats_add(&stats->timers[StatTimer_Wait], sched_wait(t->opts.sched, t->opts.copy_class, fill, &t->ring.cancelled));
+    }
+    return armGetSystemTick();
+}
+
+static void pay_turn(thread_t *t, u64 turn)
+{
+    if (t->opts.sched) sched_charge(t->opts.sched, t->opts.copy_class, armGetSystemTick() - turn);
+}
+
+//  Reads a small file and as many more after it as fit, into one slot.
+//  Returns false if cancelled.
+static bool read_packed(thread_t *t, copy_job_t *job, stage_stats_t *stats)
+{
+    slot_t *slot = ring_claim(&t->ring);
+    if (!slot)
+    {
+        atomic_store(&job->result, -1);
+        return false;
+    }
+
+    u64 start = take_turn(t, stats, true);
+    size_t capacity = t->ring.pool->buffer_size;
+    size_t used = 0;
+    size_t count = 0;
+
+    do
+    {
+        file_t file;
+        if (!file_open_read(&file, t->opts.backend, job->src))
+        {
+            print_console("failed to open %s\n\n", job->src);
+            fail_job(t, job);
+            continue;
+        }
+
+        pack_entry_t *entry = &slot->pack[count++];
+        entry->job = job;
+        entry->offset = used;
+        entry->size = file_read(&file, (u8 *)slot->data + used, job->size);
+        entry->error = entry->size != job->size;
+        file_close(&file);
+
+        if (entry->error) fail_job(t, job);
+        used += entry->size;
+    } while (count < PACK_MAX_ENTRIES && (job = job_queue_pop_packable(t->queue, capacity - used)));
+
+    stats_add(&stats->timers[StatTimer_Io], armGetSystemTick() - start);
+    stats->bytes += used;
+    atomic_fetch_add(&t->data_read, used);
+    pay_turn(t, start);
+
+    //  Not pushing it leaves the slot claimed, so the next claim gets it back.
+    if (count == 0) return true;
+
+    TRACE(TRACE_DEBUG, "packed %lu files, %lu bytes\n", count, used);
+    slot->job = NULL;
+    slot->eof = false;
+    slot->error = false;
+    slot->pack_count = count;
+    slot->fetch = false;
+    slot->read_ticks = 0;
+    slot->size = used;
+    slot->src_size = used;
+    slot->chunk_size = 0;
+    slot->write_ticks = 0;
+    ring_push(&t->ring);
+    return true;
+}
+
+//  Reads a whole job (or range) into slots. Returns false if cancelled.
+static bool read_job(thread_t *t, copy_job_t *job, stage_stats_t *stats)
+{
+    bool framed = t->opts.transform == TransformType_Decompress;
+    bool fetchers = t->has_stage[Stage_Fetch];
+
+    //  The fetch threads open the file themselves, a stream or frames can only be read in order.
+    bool ahead = fetchers && !framed && !job->stream;
+
+    file_t file;
+    if (!ahead && !file_open_read(&file, t->opts.backend, job->src))
+    {
+        print_console("failed to open %s\n\n", job->src);
+        fail_job(t, job);
+        return true;
+    }
+
+    if (!ahead) file_set_cancel(&file, &t->ring.cancelled);
+    if (!ahead && job->offset && !file_seek(&file, job->offset))
+    {
+        print_console("failed to seek %s\n\n", job->src);
+        fail_job(t, job);
+        file_close(&file);
+        return true;
+    }
+
+    TRACE(TRACE_INFO, "reading %s\n", job->src);
+
+    //  Always send at least one slot, so that an empty file still gets created.
+    size_t done = 0;
+    bool last = false;
+    do
+    {
+        //  The claimed slot is ours until we push it, so we read straight into it.
+        slot_t *slot = ring_claim(&t->ring);
+        if (!slot)
+        {
+            //  Cancelled, nobody is going to take any more slots.
+            atomic_store(&job->result, -1);
+            if (!ahead) file_close(&file);
+            return false;
+        }
+
+        //  The slot comes back with how long its last write took, which feeds the tuner.
+        if (t->opts.adaptive && slot->write_ticks)
+        {
+            tuner_add_write(&t->tuner, slot->chunk_size, slot->size, slot->write_ticks);
+        }
+        if (t->opts.adaptive && slot->read_ticks)
+        {
+            tuner_add_read(&t->tuner, slot->chunk_size, slot->src_size, slot->read_ticks);
+        }
+
+        //  With fetch threads they take the turn, as they do the reading.
+        u64 turn = ahead ? 0 : take_turn(t, stats, true);
+        size_t chunk_size = t->opts.adaptive ? tuner_next(&t->tuner) : t->opts.chunk_size;
+        size_t start_done = done;
+        size_t bufsize = chunk_size;
+        bool error = false;
+        if (framed)
+            bufsize = read_frame_header(t, &file, job, &done, &error);
+        else if (!job->stream && done + bufsize > job->size)
+            bufsize = job->size - done;
+
+        slot->fetch = ahead;
+        slot->read_ticks = 0;
+        if (ahead)
+        {
+            //  Left for a fetch thread, which sets the size to what it really read.
+            slot->fetch_offset = job->offset + done;
+            slot->size = bufsize;
+        }
+        else
+        {
+            TRACE(TRACE_DEBUG, "reading %lu bytes at %lu\n", bufsize, job->offset + done);
+            u64 start = armGetSystemTick();
+            slot->size = file_read(&file, slot->data, bufsize);
+            u64 ticks = armGetSystemTick() - start;
+            stats_add(&stats->timers[StatTimer_Io], ticks);
+            stats->bytes += slot->size;
+            atomic_fetch_add(&t->data_read, slot->size);
+            //  The slot says it's bad so that nothing after us uses it, then the job (and likely the copy) fails.
+            //  A stream has no size to check against, it just ends with a short read, unless the connection broke.
+            if (!job->stream) error |= slot->size != bufsize;
+            else if (file.failed)
+            {
+                if (!atomic_load(&t->ring.cancelled)) print_console("lost the connection to %s\n\n", job->src);
+                error = true;
+            }
+            if (error) fail_job(t, job);
+
+            if (t->opts.adaptive) tuner_add_read(&t->tuner, chunk_size, slot->size, ticks);
+        }
+        if (!ahead) pay_turn(t, turn);
+        slot->chunk_size = chunk_size;
+        slot->write_ticks = 0;
+
+        slot->job = job;
+        slot->eof = false;
+        slot->error = error;
+        slot->pack_count = 0;
+        slot->first = start_done == 0;
+        done += job->stream ? slot->size : bufsize;
+        slot->src_size = done - start_done;
+
+        //  Nothing more of a job is sent after a bad slot, so it goes out as the last one.
+        last = error || (job->stream ? slot->size < bufsize : done >= job->size);
+        slot->last = last;
+
+        //  Hand the filled slot over to the write thread.
+        ring_push(&t->ring);
+    } while (!last);
+
+    if (!ahead) file_close(&file);
+    return true;
+}
+
+//  The read thread function.
+static void thrd_read(void *in)
+{
+    thread_t *t = ((worker_t *)in)->lane;
+    stage_stats_t *stats = &t->stats[t->ring_stage[Stage_Read]];
+
+    copy_job_t *job;
+    while ((job = job_queue_pop(t->queue)))
+    {
+        if (t->opts.sched) sched_join(t->opts.sched, t->opts.copy_class);
+        bool ok = job->pack ? read_packed(t, job, stats) : read_job(t, job, stats);
+        if (t->opts.sched) sched_leave(t->opts.sched, t->opts.copy_class);
+        if (!ok) return;
+    }
+
+    //  A slot without a job tells the write thread that there's nothing left.
+    send_end_of_stream(t);
+}
+
+//  A fetch thread function, there can be a few of these taking turns with the slots.
+//  Keeps a handle to whichever file its last slot was from, so that it only opens each file once.
+static void thrd_fetch(void *in)
+{
+    worker_t *w = (worker_t *)in;
+    thread_t *t = w->lane;
+    stage_stats_t *stats = &t->stats[w->stage];
+
+    file_t file;
+    copy_job_t *open_job = NULL;
+
+    for (size_t eos = 0; eos < eos_needed(t, w->stage); )
+    {
+        slot_t *slot = ring_acquire(&t->ring, w->stage);
+        if (!slot) break;
+        if (slot->eof)
+        {
+            ring_release(&t->ring, w->stage);
+            eos++;
+            continue;
+        }
+
+        copy_job_t *job = slot->job;
+        if (slot->fetch && job != open_job)
+        {
+            if (open_job) file_close(&file);
+            open_job = file_open_read(&file, t->opts.backend, job->src) ? job : NULL;
+        }
+
+        //  Once a job has failed there's no point reading the rest of it.
+        if (slot->fetch && (!open_job || atomic_load(&job->result) != 0 || !file_seek(&file, slot->fetch_offset)))
+        {
+            if (atomic_load(&job->result) == 0) print_console("failed to read %s\n\n", job->src);
+            slot->error = true;
+            slot->size = 0;
+            fail_job(t, job);
+        }
+        else if (slot->fetch)
+        {
+            size_t want = slot->size;
+            TRACE(TRACE_DEBUG, "fetching %lu bytes at %lu\n", want, slot->fetch_offset);
+            //  The slot is already in the ring, so only the turn is waited for, not a share of the slots.
+            u64 start = take_turn(t, stats, false);
+            slot->size = file_read(&file, slot->data, want);
+            slot->read_ticks = armGetSystemTick() - start;
+            pay_turn(t, start);
+            stats_add(&stats->timers[StatTimer_Io], slot->read_ticks);
+            stats->bytes += slot->size;
+            atomic_fetch_add(&t->data_read, slot->size);
+
+            if (slot->size != want)
+            {
+                slot->error = true;
+                fail_job(t, job);
+            }
+        }
+
+        //  Shut the file as soon as its last slot is read rather than when the next job comes along.
+        if (open_job && slot->last)
+        {
+            file_close(&file);
+            open_job = NULL;
+        }
+
+        ring_release(&t->ring, w->stage);
+    }
+
+    if (open_job) file_close(&file);
+}
+
+//  The hash thread function, sits between the read and write threads.
+//  Io time in its stats is time spent hashing.
+static void thrd_hash(void *in)
+{
+    thread_t *t = ((worker_t *)in)->lane;
+    size_t stage = t->ring_stage[Stage_Hash];
+    stage_stats_t *stats = &t->stats[stage];
+
+    for (size_t eos = 0; eos < eos_needed(t, stage); )
+    {
+        slot_t *slot = ring_acquire(&t->ring, stage);
+        if (!slot) break;
+        copy_job_t *job = slot->job;
+        if (slot->eof)
+        {
+            ring_release(&t->ring, stage);
+            eos++;
+            continue;
+        }
+
+        //  Each packed file is whole, so it is hashed start to finish.
+        for (size_t i = 0; i < slot->pack_count; i++)
+        {
+            pack_entry_t *entry = &slot->pack[i];
+            u64 start = armGetSystemTick();
+            hash_init(&entry->job->hash, t->opts.hash);
+            hash_update(&entry->job->hash, (const u8 *)slot->data + entry->offset, entry->size);
+            hash_final(&entry->job->hash, entry->job->digest);
+            stats_add(&stats->timers[StatTimer_Io], armGetSystemTick() - start);
+            stats->bytes += entry->size;
+        }
+        if (slot->pack_count)
+        {
+            ring_release(&t->ring, stage);
+            continue;
+        }
+
+        bool hashing = t->opts.hash != HashType_None;
+        if (slot->first && hashing) hash_init(&job->hash, t->opts.hash);
+
+        u64 start = armGetSystemTick();
+        if (hashing) hash_update(&job->hash, slot->data, slot->size);
+        //  Deduplicating needs each chunk on its own as well.
+        if (t->opts.dedup && !slot->error) sha256CalculateHash(slot->digest, slot->data, slot->size);
+        stats_add(&stats->timers[StatTimer_Io], armGetSystemTick() - start);
+        stats->bytes += slot->size;
+
+        if (slot->last && hashing) hash_final(&job->hash, job->digest);
+
+        ring_release(&t->ring, stage);
+    }
+}
+
+//  A transform thread function, there can be a few of these taking turns with the slots.
+//  The output goes in the slot's spare buffer, which is then swapped with the data.
+//  Io time in its stats is time spent transforming, bytes are bytes in.
+static void thrd_transform(void *in)
+{
+    worker_t *w = (worker_t *)in;
+    thread_t *t = w->lane;
+    stage_stats_t *stats = &t->stats[w->stage];
+
+    transform_t transform;
+    bool ready = transform_init(&transform, t->opts.transform, t->opts.transform_level, t->opts.chunk_size);
+    if (!ready) print_console("failed to start %s\n\n", transform_name(t->opts.transform));
+
+    for (size_t eos = 0; eos < eos_needed(t, w->stage); )
+    {
+        slot_t *slot = ring_acquire(&t->ring, w->stage);
+        if (!slot) break;
+        copy_job_t *job = slot->job;
+        if (slot->eof)
+        {
+            ring_release(&t->ring, w->stage);
+            eos++;
+            continue;
+        }
+
+        //  Nothing to do for an empty file, or for the rest of one that already failed.
+        if (slot->size && !slot->error && atomic_load(&job->result) == 0)
+        {
+            size_t size = 0;
+            u64 start = armGetSystemTick();
+            bool ok = ready && transform_run(&transform, slot->data, slot->size, slot->spare, t->ring.pool->buffer_size, &size);
+            stats_add(&stats->timers[StatTimer_Io], armGetSystemTick() - start);
+            stats->bytes += slot->size;
+
+            if (ok)
+            {
+                void *out = slot->spare;
+                slot->spare = slot->data;
+                slot->data = out;
+                slot->size = size;
+            }
+            else
+            {
+                print_console("failed to %s %s\n\n", transform_name(t->opts.transform), job->src);
+                slot->error = true;
+                slot->size = 0;
+                fail_job(t, job);
+            }
+        }
+
+        ring_release(&t->ring, w->stage);
+    }
+
+    transform_exit(&transform);
+}
+
+//  Flushes dst, then records how far it has got so that an interrupted copy can carry on from there.
+//  end is where this slot finished in dst, the tail is the end of the slot.
+static void write_journal(file_t *file, copy_job_t *job, const slot_t *slot, s64 end)
+{
+    if (!file_flush(file)) return;
+
+    size_t tail = slot->size < JOURNAL_TAIL_SIZE ? slot->size : JOURNAL_TAIL_SIZE;
+    hash_ctx_t ctx;
+    u8 digest[HASH_MAX_SIZE];
+    hash_init(&ctx, HashType_Crc32);
+    hash_update(&ctx, (const u8 *)slot->data + slot->size - tail, tail);
+    hash_final(&ctx, digest);
+
+    journal_t journal =
+    {
+        .magic = JOURNAL_MAGIC,
+        .tail_crc = (digest[0] << 24) | (digest[1] << 16) | (digest[2] << 8) | digest[3],
+        .file_size = job->offset + job->size,
+        .offset = end,
+        .tail_size = tail,
+    };
+    if (!journal_save(job->dst, &journal)) TRACE(TRACE_INFO, "failed to write journal of %s\n", job->dst);
+}
+
+void commit_gate_init(commit_gate_t *g)
+{
+    memset(g, 0, sizeof(commit_gate_t));
+    mutexInit(&g->mtx);
+}
+
+void commit_gate_open(commit_gate_t *g)
+{
+    if (!g) return;
+
+    mutexLock(&g->mtx);
+    g->open++;
+    mutexUnlock(&g->mtx);
+}
+
+//  Both paths are on the same filesystem, that is they have the same "device:" at the start.
+static bool same_fs(const char *a, const char *b)
+{
+    const char *colon = strchr(a, ':');
+    size_t len = colon ? (size_t)(colon - a) + 1 : strlen(a) + 1;
+    return !strncmp(a, b, len);
+}
+
+bool commit_gate_close(commit_gate_t *g, const char *path)
+{
+    if (!g) return true;
+
+    mutexLock(&g->mtx);
+    g->open--;
+
+    bool ok = true;
+    if (path)
+    {
+        size_t i = 0;
+        while (i < g->pending && !same_fs(g->paths[i], path)) i++;
+        if (i == COMMIT_GATE_MAX_FS) ok = false;
+        else if (i == g->pending) snprintf(g->paths[g->pending++], FS_MAX_PATH, "%s", path);
+    }
+
+    if (g->open == 0)
+    {
+        for (size_t i = 0; i < g->pending; i++)
+        {
+            ok &= file_commit(g->paths[i]);
+        }
+        g->pending = 0;
+    }
+    mutexUnlock(&g->mtx);
+    return ok;
+}
+
+//  Flushes dst. The time counts as writing.
+static bool flush_dst(thread_t *t, file_t *file, copy_job_t *job, stage_stats_t *stats)
+{
+    u64 start = armGetSystemTick();
+    bool ok = file_flush(file);
+    stats_add(&stats->timers[StatTimer_Io], armGetSystemTick() - start);
+    if (!ok)
+    {
+        print_console("failed to flush %s\n\n", job->dst);
+        fail_job(t, job);
+    }
+    return ok;
+}
+
+//  Deduplicating, adds the chunk to the store if it isn't already there and writes a reference to it.
+//  Returns the slot size on success like file_write, skipped is how much of it was already stored.
+static size_t write_ref(thread_t *t, file_t *file, const slot_t *slot, size_t *skipped)
+{
+    //  An empty file is a recipe with no chunks.
+    if (!slot->size) return 0;
+
+    dedup_ref_t ref;
+    bool added = false;
+    if (!dedup_put(t->opts.dedup, slot->digest, slot->data, slot->size, &ref, &added)) return 0;
+    if (file_write(file, &ref, sizeof(ref)) != sizeof(ref)) return 0;
+
+    *skipped = added ? 0 : slot->size;
+    return slot->size;
+}
+
+//  Writes each of the small files in a packed slot, back to back.
+//  The slot holds the commit gate open throughout, so that it is committed once rather than per file.
+static void write_packed(thread_t *t, slot_t *slot, stage_stats_t *stats)
+{
+    commit_gate_t *gate = t->opts.commit ? t->opts.commit_gate : NULL;
+    commit_gate_open(gate);
+    const char *committed = NULL;   // a dst that was written, nothing is committed if none were.
+
+    for (size_t i = 0; i < slot->pack_count; i++)
+    {
+        pack_entry_t *entry = &slot->pack[i];
+        copy_job_t *job = entry->job;
+        job->finished = true;
+        if (entry->error) continue;
+
+        file_t file;
+        if (!file_open_write(&file, t->opts.backend, job->dst))
+        {
+            print_console("failed to create %s\n\n", job->dst);
+            fail_job(t, job);
+            continue;
+        }
+
+        u64 start = take_turn(t, stats, false);
+        size_t written = file_write(&file, (const u8 *)slot->data + entry->offset, entry->size);
+        stats_add(&stats->timers[StatTimer_Io], armGetSystemTick() - start);
+        pay_turn(t, start);
+        stats->bytes += written;
+
+        if (written != entry->size) fail_job(t, job);
+        //  Each small file is a chunk of its own. Committing waits for the end of the slot.
+        else if (t->opts.flush == FlushPolicy_Chunk && !file_flush(&file)) fail_job(t, job);
+        else committed = job->dst;
+        file_close(&file);
+        atomic_fetch_add(&job->data_written, written);
+        atomic_fetch_add(&t->data_written, written);
+        atomic_fetch_add(&t->data_done, entry->size);
+    }
+
+    if (!commit_gate_close(gate, committed))
+    {
+        print_console("failed to commit %s\n\n", committed ? committed : slot->pack[0].job->dst);
+        for (size_t i = 0; i < slot->pack_count; i++)
+        {
+            if (atomic_load(&slot->pack[i].job->result) == 0) fail_job(t, slot->pack[i].job);
+        }
+    }
+}
+
+//  The gate a job's dst goes through, NULL if it's not being committed.
+static commit_gate_t *gate_for(const thread_t *t, const copy_job_t *job)
+{
+    return t->opts.commit && !file_is_stream(job->dst) ? t->opts.commit_gate : NULL;
+}
+
+//  Done writing a job, closes dst and commits it when asked to. Returns false if the commit failed.
+//  A split file stays open until the last of its ranges is done with it.
+static bool close_dst(thread_t *t, copy_job_t *job, file_t *file)
+{
+    if (!job->split) file_close(file);
+    else if (atomic_fetch_sub(&job->split->ranges_left, 1) == 1) file_close(&job->split->file);
+    else return true;
+
+    //  Save data loses the file unless it's committed, whatever the flush policy.
+    return commit_gate_close(gate_for(t, job), atomic_load(&job->result) == 0 ? job->dst : NULL);
+}
+
+//  The write thread function.
+static void thrd_write(void *in)
+{
+    thread_t *t = ((worker_t *)in)->lane;
+    size_t stage = t->ring_stage[Stage_Write];
+    stage_stats_t *stats = &t->stats[stage];
+
+    file_t file;
+    bool is_open = false;
+    bool shared = false;        // file is a split file's handle, see split_file_t.
+    commit_gate_t *gate = NULL; // that the open file went through.
+    size_t since_journal = 0;
+    size_t since_flush = 0;
+    bool journaled = false;
+    bool sparse = false;
+
+    for (size_t eos = 0; eos < eos_needed(t, stage); )
+    {
+        slot_t *slot = ring_peek(&t->ring);
+        if (!slot) break;
+        copy_job_t *job = slot->job;
+        if (slot->eof)
+        {
+            ring_pop(&t->ring);
+            eos++;
+            continue;
+        }
+
+        if (slot->pack_count)
+        {
+            write_packed(t, slot, stats);
+            ring_pop(&t->ring);
+            continue;
+        }
+
+        if (slot->first)
+        {
+            since_journal = 0;
+            since_flush = 0;
+            journaled = false;
+            sparse = false;
+        }
+
+        if (slot->first && job->create)
+        {
+            shared = false;
+            gate = gate_for(t, job);
+            commit_gate_open(gate);
+            is_open = file_open_write(&file, t->opts.backend, job->dst);
+            if (is_open) file_set_cancel(&file, &t->ring.cancelled);
+            if (!is_open)
+            {
+                commit_gate_close(gate, NULL);
+                print_console("failed to create %s\n\n", job->dst);
+                fail_job(t, job);
+            }
+            //  A recipe starts with its magic, and is nothing like the size of the file.
+            else if (t->opts.dedup)
+            {
+                u32 magic = DEDUP_RECIPE_MAGIC;
+                if (file_write(&file, &magic, sizeof(magic)) != sizeof(magic)) fail_job(t, job);
+            }
+            //  We already know how big the file will be, so size it once now rather than
+            //  having the filesystem grow it on every write. Not fatal if it fails.
+            //  Unless it's being transformed, then we don't know until the end.
+            else if (t->opts.preallocate && t->opts.transform == TransformType_None && job->size &&
+                !file_set_size(&file, job->size))
+            {
+                print_console("failed to preallocate %s\n\n", job->dst);
+            }
+            //  Only a file we just sized ourselves is known to be zeros already.
+            else if (t->opts.sparse_block && t->opts.preallocate && t->opts.transform == TransformType_None &&
+                job->size && !file_is_stream(job->dst))
+            {
+                sparse = true;
+            }
+        }
+        else if (slot->first)
+        {
+            //  One range of a split file (or the rest of a resumed one), the file already exists
+            //  so just write our part in place. A split file's ranges share its handle.
+            //  The engine opened a split file through the gate itself.
+            shared = job->split != NULL;
+            gate = shared ? NULL : gate_for(t, job);
+            if (shared) file = job->split->file;
+            commit_gate_open(gate);
+            is_open = shared || file_open_existing(&file, t->opts.backend, job->dst);
+            if (is_open && !file_seek(&file, job->offset))
+            {
+                if (!shared) file_close(&file);
+                is_open = false;
+            }
+            if (!is_open)
+            {
+                commit_gate_close(gate, NULL);
+                print_console("failed to open %s\n\n", job->dst);
+                fail_job(t, job);
+            }
+        }
+
+        //  A bad slot is never written, the job has already failed.
+        if (is_open && !slot->error)
+        {
+            TRACE(TRACE_DEBUG, "writing %lu bytes to %s\n", slot->size, job->dst);
+            u64 start = take_turn(t, stats, false);
+            size_t skipped = 0;
+            size_t written;
+            if (t->opts.dedup) written = write_ref(t, &file, slot, &skipped);
+            else if (sparse) written = sparse_write(&file, slot->data, slot->size, t->opts.sparse_block, &skipped);
+            else written = file_write(&file, slot->data, slot->size);
+            slot->write_ticks = armGetSystemTick() - start;
+            pay_turn(t, start);
+            stats_add(&stats->timers[StatTimer_Io], slot->write_ticks);
+            stats->bytes += written - skipped;
+            stats->skipped += skipped;
+            if (written != slot->size) fail_job(t, job);
+            atomic_fetch_add(&job->data_written, written);
+            atomic_fetch_add(&t->data_written, written);
+            atomic_fetch_add(&t->data_done, slot->src_size);
+
+            since_journal += written;
+            since_flush += written;
+            bool flush = t->opts.flush == FlushPolicy_Chunk ||
+                (t->opts.flush == FlushPolicy_Interval && (slot->last || since_flush >= t->opts.flush_interval));
+            if (flush && atomic_load(&job->result) == 0 && flush_dst(t, &file, job, stats)) since_flush = 0;
+
+            if (job->journal && !slot->last && atomic_load(&job->result) == 0 && since_journal >= JOURNAL_INTERVAL)
+            {
+                write_journal(&file, job, slot, job->offset + atomic_load(&job->data_written));
+                since_journal = 0;
+                journaled = true;
+            }
+        }
+
+        if (slot->last && is_open)
+        {
+            TRACE(TRACE_INFO, "finished %s\n", job->dst);
+            bool committed = close_dst(t, job, &file);
+            is_open = false;
+            if (!committed)
+            {
+                print_console("failed to commit %s\n\n", job->dst);
+                fail_job(t, job);
+            }
+
+            //  A failed copy keeps its journal, so it can carry on from there next time.
+            //  There is only one to remove if we wrote one, or this was resumed from one.
+            if (job->journal && atomic_load(&job->result) == 0 && (journaled || !job->create)) journal_remove(job->dst);
+        }
+        if (slot->last) job->finished = true;
+
+        //  Hand the empty slot back to the read thread.
+        ring_pop(&t->ring);
+    }
+
+    //  Only still open if cancelled, the journal stays so that it can be resumed.
+    //  A split file is left for the engine to close.
+    if (is_open && !shared)
+    {
+        file_close(&file);
+        commit_gate_close(gate, NULL);
+    }
+}
+
+static size_t gcd(size_t a, size_t b)
+{
+    while (b)
+    {
+        size_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+int pipeline_resolve_prio(int prio)
+{
+    if (prio != PRIO_DEFAULT) return prio;
+
+    s32 current = 0x2C;
+    svcGetThreadPriority(&current, CUR_THREAD_HANDLE);
+    return current;
+}
+
+size_t pipeline_buffer_size(const copy_opts_t *opts)
+{
+    return transform_bound(opts->transform, opts->chunk_size);
+}
+
+bool pipeline_start(thread_t *t, job_queue_t *queue, const copy_opts_t *opts, const int cores[Stage_Count])
+{
+    if (!t || !queue || !opts) return false;
+
+    memset(t, 0, sizeof(thread_t));
+    t->queue = queue;
+    t->opts = *opts;
+    atomic_init(&t->data_read, 0);
+    atomic_init(&t->data_written, 0);
+    atomic_init(&t->data_done, 0);
+
+    //  Compressed input is read a whole frame at a time, so there is no chunk size to tune.
+    if (opts->transform == TransformType_Decompress) t->opts.adaptive = false;
+
+    size_t workers = opts->transform_workers ? opts->transform_workers : 1;
+    if (workers > TRANSFORM_MAX_WORKERS || workers > opts->slot_count) return false;
+
+    //  Reading ahead needs explicit offsets, which stdio doesn't have.
+    size_t fetchers = opts->backend == FileBackend_Native ? opts->read_ahead : 0;
+    if (fetchers > FETCH_MAX_THREADS || fetchers > opts->slot_count) return false;
+
+    t->stage_threads[Stage_Read] = 1;
+    t->stage_threads[Stage_Fetch] = fetchers;
+    t->stage_threads[Stage_Hash] = opts->hash != HashType_None || opts->dedup;
+    t->stage_threads[Stage_Transform] = opts->transform != TransformType_None ? workers : 0;
+    t->stage_threads[Stage_Write] = 1;
+
+    //  Enough end of stream slots for every thread of every group to see a whole number of them.
+    t->eos_count = 1;
+    for (size_t i = 0; i < Stage_Count; i++)
+    {
+        size_t n = t->stage_threads[i];
+        if (n > 1 && t->eos_count % n) t->eos_count *= n / gcd(t->eos_count, n);
+    }
+
+    //  Ring stages in the order data goes through them, each stage is a group of its threads.
+    size_t group_sizes[Stage_Count];
+    size_t group_count = 0;
+    size_t stage_count = 0;
+    for (size_t i = 0; i < Stage_Count; i++)
+    {
+        t->has_stage[i] = t->stage_threads[i] != 0;
+        if (!t->has_stage[i]) continue;
+
+        t->ring_stage[i] = stage_count;
+        group_sizes[group_count++] = t->stage_threads[i];
+        stage_count += t->stage_threads[i];
+    }
+
+    if (!opts->pool || opts->chunk_size == 0 || pipeline_buffer_size(opts) > opts->pool->buffer_size) return false;
+    if (!ring_init(&t->ring, opts->slot_count, group_sizes, group_count, opts->pool, t->has_stage[Stage_Transform]))
+    {
+        return false;
+    }
+    tuner_init(&t->tuner, opts->chunk_size);
+
+    ThreadFunc entries[Stage_Count] = { thrd_read, thrd_fetch, thrd_hash, thrd_transform, thrd_write };
+    int prios[Stage_Count] =
+    {
+        pipeline_resolve_prio(opts->read_prio),
+        pipeline_resolve_prio(opts->read_prio),
+        pipeline_resolve_prio(opts->read_prio),
+        pipeline_resolve_prio(opts->read_prio),
+        pipeline_resolve_prio(opts->write_prio),
+    };
+
+    //  Thread i of the lane is for ring stage i.
+    size_t created = 0;
+    for (size_t i = 0; i < Stage_Count; i++)
+    {
+        for (size_t n = 0; n < t->stage_threads[i]; n++)
+        {
+            size_t stage = t->ring_stage[i] + n;
+            //  Threads of a group are spread from the group's core onwards, unless given a core.
+            int core = cores[i];
+            bool spread = i == Stage_Fetch ? opts->read_core == CORE_AUTO : opts->transform_core == CORE_AUTO;
+            if (n && core >= 0 && spread) core = (core + n) % CORE_COUNT;
+
+            t->workers[stage].lane = t;
+            t->workers[stage].stage = stage;
+            t->ring.stats[stage] = &t->stats[stage];
+            if (R_FAILED(threadCreate(&t->threads[stage], entries[i], &t->workers[stage], NULL, THREAD_STACK_SIZE, prios[i], core)))
+            {
+                break;
+            }
+            created++;
+        }
+        if (t->has_stage[i] && created != t->ring_stage[i] + t->stage_threads[i]) break;
+    }
+
+    if (created != stage_count)
+    {
+        for (size_t i = 0; i < created; i++)
+        {
+            threadClose(&t->threads[i]);
+        }
+        ring_exit(&t->ring);
+        return false;
+    }
+
+    //  The writer goes first, it just sleeps until there is something in the ring.
+    for (size_t i = stage_count; i-- > 0; )
+    {
+        if (R_FAILED(threadStart(&t->threads[i])))
+        {
+            //  Stop the ones that did start ourselves, as nothing else will.
+            //  Cancelling rather than passing the end of stream through the stages that didn't start,
+            //  as there can be more end of stream slots than the ring has room for.
+            ring_cancel(&t->ring);
+            for (size_t j = i + 1; j < stage_count; j++)
+            {
+                threadWaitForExit(&t->threads[j]);
+            }
+            for (size_t j = 0; j < stage_count; j++)
+            {
+                threadClose(&t->threads[j]);
+            }
+            ring_exit(&t->ring);
+            return false;
+        }
+    }
+
+    //  The lane's slots count towards its class's share from now on.
+    if (opts->sched) sched_add_ring(opts->sched, opts->copy_class, &t->ring);
+    return true;
+}
+
+void pipeline_join(thread_t *t)
+{
+    for (size_t i = 0; i < t->ring.stage_count; i++)
+    {
+        threadWaitForExit(&t->threads[i]);
+    }
+    for (size_t i = 0; i < t->ring.stage_count; i++)
+    {
+        threadClose(&t->threads[i]);
+    }
+    if (t->opts.sched) sched_remove_ring(t->opts.sched, &t->ring);
+    ring_exit(&t->ring);
+}
+
+bool pipeline_wait(thread_t *t, u64 timeout_ns)
+{
+    //  A thread handle is signalled once the thread has exited, and stays that way.
+    for (size_t i = 0; i < t->ring.stage_count; i++)
+    {
+        if (R_FAILED(waitSingleHandle(t->threads[i].handle, timeout_ns))) return false;
+    }
+    return true;
+}
+
+void pipeline_cancel(thread_t *t)
+{
+    ring_cancel(&t->ring);
+}
+
+void pipeline_stage_stats(const thread_t *t, Stage stage, stage_stats_t *out)
+{
+    for (size_t i = 0; i < t->stage_threads[stage]; i++)
+    {
+        stats_merge(out, &t->stats[t->ring_stage[stage] + i]);
+    }
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <switch.h>
+
+#include "progress.h"
+#include "console.h"
+
+
+//  The rows of progress_graph, so that it knows how far to go back up.
+#define GRAPH_LINES (PROGRESS_GRAPH_HEIGHT + 2)
+
+
+//  done is counted in bytes of the source, so that compressing still gets to 100%.
+void progress_print(size_t done, size_t total, u64 elapsed_ticks, void *user)
+{
+    u64 ns = armTicksToNs(elapsed_ticks);
+    double mbs = ns ? (double)done / (1024.0 * 1024.0) / ((double)ns / 1e9) : 0.0;
+
+    print_console("\r%lu / %lu MiB (%3lu%%) %8.2f MB/s ",
+        done >> 20, total >> 20, total ? done * 100 / total : 100, mbs);
+}
+
+//  How many rows of the graph a speed fills, rounding up so that anything at all shows.
+static size_t bar_height(double mbs, double scale)
+{
+    if (mbs <= 0.0) return 0;
+    size_t rows = (size_t)(mbs / scale * PROGRESS_GRAPH_HEIGHT + 0.999);
+    return rows > PROGRESS_GRAPH_HEIGHT ? PROGRESS_GRAPH_HEIGHT : rows;
+}
+
+void progress_graph(telemetry_t *tel, size_t done, size_t total, bool redraw)
+{
+    telemetry_sample_t samples[PROGRESS_GRAPH_WIDTH];
+    size_t count = telemetry_latest(tel, samples, PROGRESS_GRAPH_WIDTH);
+
+    double read[PROGRESS_GRAPH_WIDTH];
+    double write[PROGRESS_GRAPH_WIDTH];
+    double peak = 0.0;
+    for (size_t i = 0; i < count; i++)
+    {
+        read[i] = telemetry_rate(samples[i].bytes_read, samples[i].ticks);
+        write[i] = telemetry_rate(samples[i].bytes_written, samples[i].ticks);
+        if (read[i] > peak) peak = read[i];
+        if (write[i] > peak) peak = write[i];
+    }
+
+    //  Scale to the fastest second on screen, in whole steps of 5 MB/s so the axis doesn't jitter.
+    double scale = peak > 0.0 ? (double)((size_t)(peak / 5.0) + 1) * 5.0 : 5.0;
+
+    //  Built up as one string so that it goes to the console in one go.
+    //  Every line is kept under the console's 80 columns, as one that wraps would throw off the redraw.
+    char text[GRAPH_LINES * (PROGRESS_GRAPH_WIDTH + 32)];
+    size_t len = 0;
+    if (redraw) len += snprintf(text + len, sizeof(text) - len, "\x1b[%dA", GRAPH_LINES);
+
+    for (size_t row = PROGRESS_GRAPH_HEIGHT; row > 0; row--)
+    {
+        if (row == PROGRESS_GRAPH_HEIGHT) len += snprintf(text + len, sizeof(text) - len, "\r%6.0f |", scale);
+        else len += snprintf(text + len, sizeof(text) - len, "\r       |");
+
+        for (size_t i = 0; i < PROGRESS_GRAPH_WIDTH; i++)
+        {
+            char c = ' ';
+            if (i < count && bar_height(write[i], scale) >= row) c = '#';
+            else if (i < count && bar_height(read[i], scale) >= row) c = ':';
+            text[len++] = c;
+        }
+        len += snprintf(text + len, sizeof(text) - len, "\x1b[K\n");
+    }
+    len += snprintf(text + len, sizeof(text) - len, "\r  MB/s +%.*s\x1b[K\n", PROGRESS_GRAPH_WIDTH,
+        "----------------------------------------------------------------------------------------------------");
+
+    const telemetry_sample_t *last = count ? &samples[count - 1] : NULL;
+    snprintf(text + len, sizeof(text) - len, "\r%lu / %lu MiB (%3lu%%) read %.1f write %.1f MB/s, %lu queued, %.0fms stall\x1b[K\n",
+        done >> 20, total >> 20, total ? done * 100 / total : 100,
+        count ? read[count - 1] : 0.0, count ? write[count - 1] : 0.0,
+        last ? last->queue_depth : 0, last ? (double)armTicksToNs(last->stall_ticks) / 1e6 : 0.0);
+
+    print_console("%s", text);
+}
@@ -0,0 +1,216 @@
+#include <string.h>
+#include <switch.h>
+
+#include "ring.h"
+
+
+//  Blocks until the counter reaches need, or the ring is cancelled.
+//  The waiting flag is set before the final check so that the other thread cannot miss us.
+static void ring_wait(ring_t *r, atomic_size_t *counter, size_t need, size_t stage)
+{
+    if (atomic_load_explicit(counter, memory_order_acquire) >= need) return;
+
+    u64 start = armGetSystemTick();
+    stage_stats_t *stats = r->stats[stage];
+    bool end = stage == 0 || stage == r->stage_count - 1;
+
+    if (sync_spin_until(&r->spin[stage], counter, need, &r->cancelled))
+    {
+        u64 ticks = armGetSystemTick() - start;
+        if (stats) stats_add(&stats->timers[StatTimer_Wait], ticks);
+        if (end) atomic_fetch_add_explicit(&r->stall_ticks, ticks, memory_order_relaxed);
+        return;
+    }
+
+    u64 asleep = 0;
+    mutexLock(&r->mtx);
+    u64 locked = armGetSystemTick();
+    atomic_store(&r->waiting[stage], true);
+    while (atomic_load(counter) < need && !atomic_load(&r->cancelled))
+    {
+        u64 sleep_start = armGetSystemTick();
+        condvarWait(&r->can_run[stage], &r->mtx);
+        asleep += armGetSystemTick() - sleep_start;
+    }
+    atomic_store(&r->waiting[stage], false);
+    mutexUnlock(&r->mtx);
+
+    u64 now = armGetSystemTick();
+    if (stats)
+    {
+        stats_add(&stats->timers[StatTimer_Wait], now - start);
+        stats_add(&stats->timers[StatTimer_Lock], now - locked - asleep);
+    }
+    if (end) atomic_fetch_add_explicit(&r->stall_ticks, now - start, memory_order_relaxed);
+}
+
+//  Publishes a new counter value, only waking the stages of the next group that are asleep.
+//  In a striped group only one of them is waiting on this counter, the rest just check again.
+static void ring_publish(ring_t *r, size_t stage, size_t value)
+{
+    atomic_store(&r->pos[stage], value);
+
+    size_t group = r->group_of[stage] + 1 == r->group_count ? 0 : r->group_of[stage] + 1;
+    for (size_t i = 0; i < r->group_size[group]; i++)
+    {
+        size_t next = r->group_first[group] + i;
+        if (!atomic_load(&r->waiting[next])) continue;
+
+        mutexLock(&r->mtx);
+        u64 locked = armGetSystemTick();
+        condvarWakeOne(&r->can_run[next]);
+        mutexUnlock(&r->mtx);
+
+        if (r->stats[stage]) stats_add(&r->stats[stage]->timers[StatTimer_Lock], armGetSystemTick() - locked);
+    }
+}
+
+bool ring_init(ring_t *r, size_t slot_count, const size_t *group_sizes, size_t group_count,
+    buffer_pool_t *pool, bool spare)
+{
+    if (!r || !group_sizes || !pool || slot_count == 0 || slot_count > MAX_SLOTS) return false;
+    if (group_count < 2 || group_count > RING_MAX_GROUPS) return false;
+    if (group_sizes[0] != 1 || group_sizes[group_count - 1] != 1) return false;
+
+    memset(r, 0, sizeof(ring_t));
+    r->slot_count = slot_count;
+    r->group_count = group_count;
+    r->pool = pool;
+    r->has_spare = spare;
+    atomic_init(&r->cancelled, false);
+    atomic_init(&r->stall_ticks, 0);
+
+    for (size_t g = 0; g < group_count; g++)
+    {
+        //  A striped group can't be wider than the ring, or some of it would never get a slot.
+        if (group_sizes[g] == 0 || group_sizes[g] > slot_count) return false;
+        if (r->stage_count + group_sizes[g] > RING_MAX_STAGES) return false;
+
+        r->group_first[g] = r->stage_count;
+        r->group_size[g] = group_sizes[g];
+        for (size_t i = 0; i < group_sizes[g]; i++)
+        {
+            r->group_of[r->stage_count + i] = g;
+        }
+        r->stage_count += group_sizes[g];
+    }
+
+    //  Stage i of a group starts at slot i.
+    mutexInit(&r->mtx);
+    for (size_t i = 0; i < r->stage_count; i++)
+    {
+        atomic_init(&r->pos[i], i - r->group_first[r->group_of[i]]);
+        atomic_init(&r->waiting[i], false);
+        sync_spin_init(&r->spin[i], true);
+        condvarInit(&r->can_run[i]);
+    }
+
+    //  Every buffer or none, see buffer_pool.h.
+    void *buffers[MAX_SLOTS * 2];
+    size_t per_slot = spare ? 2 : 1;
+    if (!pool_lease_many(pool, buffers, slot_count * per_slot))
+    {
+        ring_exit(r);
+        r->lease_failed = true;
+        return false;
+    }
+    for (size_t i = 0; i < slot_count; i++)
+    {
+        r->slots[i].data = buffers[i * per_slot];
+        if (spare) r->slots[i].spare = buffers[i * per_slot + 1];
+    }
+
+    return true;
+}
+
+void ring_exit(ring_t *r)
+{
+    for (size_t i = 0; i < r->slot_count; i++)
+    {
+        if (r->slots[i].data) pool_return(r->pool, r->slots[i].data);
+        if (r->slots[i].spare) pool_return(r->pool, r->slots[i].spare);
+        r->slots[i].data = NULL;
+        r->slots[i].spare = NULL;
+    }
+    //  libnx's Mutex / CondVar are just words, there is nothing to destroy.
+}
+
+void ring_set_spin(ring_t *r, bool enabled)
+{
+    for (size_t i = 0; i < r->stage_count; i++)
+    {
+        sync_spin_init(&r->spin[i], enabled);
+    }
+}
+
+slot_t *ring_acquire(ring_t *r, size_t stage)
+{
+    if (atomic_load_explicit(&r->cancelled, memory_order_relaxed)) return NULL;
+
+    size_t pos = atomic_load_explicit(&r->pos[stage], memory_order_relaxed);
+    size_t group = r->group_of[stage];
+
+    if (group == 0)
+    {
+        //  The ring is full when tail is a whole ring behind head.
+        size_t last = r->stage_count - 1;
+        if (pos >= r->slot_count) ring_wait(r, &r->pos[last], pos + 1 - r->slot_count, stage);
+    }
+    else
+    {
+        //  Wait for whichever stage of the group before us has this slot.
+        size_t prev = group - 1;
+        size_t from = r->group_first[prev] + pos % r->group_size[prev];
+        ring_wait(r, &r->pos[from], pos + 1, stage);
+    }
+
+    //  The slot is owned by this stage until it is released.
+    if (atomic_load(&r->cancelled)) return NULL;
+    return &r->slots[pos % r->slot_count];
+}
+
+void ring_release(ring_t *r, size_t stage)
+{
+    size_t pos = atomic_load_explicit(&r->pos[stage], memory_order_relaxed);
+    ring_publish(r, stage, pos + r->group_size[r->group_of[stage]]);
+}
+
+void ring_cancel(ring_t *r)
+{
+    //  Taking the mutex means that nobody can be between checking the flag and sleeping.
+    mutexLock(&r->mtx);
+    atomic_store(&r->cancelled, true);
+    for (size_t i = 0; i < r->stage_count; i++)
+    {
+        condvarWakeOne(&r->can_run[i]);
+    }
+    mutexUnlock(&r->mtx);
+}
+
+size_t ring_depth(ring_t *r)
+{
+    //  tail first, as head can only have gone further by the time it is loaded.
+    size_t tail = atomic_load(&r->pos[r->stage_count - 1]);
+    size_t head = atomic_load(&r->pos[0]);
+    return head - tail;
+}
+
+slot_t *ring_claim(ring_t *r)
+{
+    return ring_acquire(r, 0);
+}
+
+void ring_push(ring_t *r)
+{
+    ring_release(r, 0);
+}
+
+slot_t *ring_peek(ring_t *r)
+{
+    return ring_acquire(r, r->stage_count - 1);
+}
+
+void ring_pop(ring_t *r)
+{
+    ring_release(r, r->stage_count - 1);
+}
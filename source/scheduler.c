@@ -0,0 +1,168 @@
+#include <string.h>
+#include <time.h>
+
+#include "scheduler.h"
+
+
+static const char *class_names[CopyClass_Count] = { "interactive", "normal", "bulk" };
+
+bool sched_init(sched_t *s)
+{
+    if (!s) return false;
+
+    memset(s, 0, sizeof(sched_t));
+    s->weight[CopyClass_Interactive] = SCHED_WEIGHT_INTERACTIVE;
+    s->weight[CopyClass_Normal] = SCHED_WEIGHT_NORMAL;
+    s->weight[CopyClass_Bulk] = SCHED_WEIGHT_BULK;
+    s->quantum = armNsToTicks(SCHED_QUANTUM_NS);
+    s->grace = armNsToTicks(SCHED_GRACE_NS);
+
+    if (mtx_init(&s->mtx, mtx_plain) != thrd_success) return false;
+    if (cnd_init(&s->can_run) != thrd_success)
+    {
+        mtx_destroy(&s->mtx);
+        return false;
+    }
+    return true;
+}
+
+void sched_exit(sched_t *s)
+{
+    cnd_destroy(&s->can_run);
+    mtx_destroy(&s->mtx);
+}
+
+void sched_add_ring(sched_t *s, CopyClass cls, ring_t *ring)
+{
+    mtx_lock(&s->mtx);
+    if (s->ring_count < SCHED_MAX_RINGS)
+    {
+        s->rings[s->ring_count] = ring;
+        s->ring_class[s->ring_count] = cls;
+        s->ring_count++;
+    }
+    mtx_unlock(&s->mtx);
+}
+
+void sched_remove_ring(sched_t *s, ring_t *ring)
+{
+    mtx_lock(&s->mtx);
+    for (size_t i = 0; i < s->ring_count; i++)
+    {
+        if (s->rings[i] != ring) continue;
+        s->ring_count--;
+        s->rings[i] = s->rings[s->ring_count];
+        s->ring_class[i] = s->ring_class[s->ring_count];
+        break;
+    }
+    //  Its filled slots no longer count against its class.
+    cnd_broadcast(&s->can_run);
+    mtx_unlock(&s->mtx);
+}
+
+//  The least any class other than cls with a count has paid, or false if there are none.
+static bool least_paid(const sched_t *s, CopyClass cls, const size_t counts[CopyClass_Count], u64 *out)
+{
+    bool found = false;
+    for (size_t i = 0; i < CopyClass_Count; i++)
+    {
+        if (i == cls || !counts[i]) continue;
+        if (!found || s->paid[i] < *out) *out = s->paid[i];
+        found = true;
+    }
+    return found;
+}
+
+//  cls has at least its share of every ring's slots filled, shared by the weight of the classes wanting a turn.
+static bool over_slot_share(sched_t *s, CopyClass cls, const size_t wanting[CopyClass_Count])
+{
+    size_t total = 0;
+    size_t filled = 0;
+    for (size_t i = 0; i < s->ring_count; i++)
+    {
+        total += s->rings[i]->slot_count;
+        if (s->ring_class[i] == cls) filled += ring_depth(s->rings[i]);
+    }
+
+    u64 weights = 0;
+    for (size_t i = 0; i < CopyClass_Count; i++)
+    {
+        if (wanting[i] || i == cls) weights += s->weight[i];
+    }
+
+    size_t share = weights ? total * s->weight[cls] / weights : total;
+    return filled >= (share ? share : 1);
+}
+
+void sched_join(sched_t *s, CopyClass cls)
+{
+    mtx_lock(&s->mtx);
+    u64 least;
+    if (!s->jobs[cls] && least_paid(s, cls, s->jobs, &least) && s->paid[cls] < least) s->paid[cls] = least;
+    s->jobs[cls]++;
+    mtx_unlock(&s->mtx);
+}
+
+void sched_leave(sched_t *s, CopyClass cls)
+{
+    mtx_lock(&s->mtx);
+    s->jobs[cls]--;
+    mtx_unlock(&s->mtx);
+}
+
+//  A class still wants the storage for SCHED_GRACE_NS after a turn, so that another isn't let in
+//  in the moment between one chunk and the next.
+static bool held_back(sched_t *s, CopyClass cls, bool fill)
+{
+    u64 now = armGetSystemTick();
+    size_t wanting[CopyClass_Count];
+    for (size_t i = 0; i < CopyClass_Count; i++)
+    {
+        wanting[i] = s->active[i] || (s->jobs[i] && now - s->last_turn[i] < s->grace);
+    }
+
+    u64 least;
+    if (!least_paid(s, cls, wanting, &least)) return false;
+    return s->paid[cls] > least + s->quantum || (fill && over_slot_share(s, cls, wanting));
+}
+
+u64 sched_wait(sched_t *s, CopyClass cls, bool fill, const atomic_bool *cancelled)
+{
+    u64 start = armGetSystemTick();
+
+    mtx_lock(&s->mtx);
+    s->active[cls]++;
+
+    while (held_back(s, cls, fill))
+    {
+        if (cancelled && atomic_load(cancelled)) break;
+
+        struct timespec until;
+        timespec_get(&until, TIME_UTC);
+        until.tv_nsec += SCHED_POLL_NS;
+        if (until.tv_nsec >= 1000000000L)
+        {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        cnd_timedwait(&s->can_run, &s->mtx, &until);
+    }
+    mtx_unlock(&s->mtx);
+
+    return armGetSystemTick() - start;
+}
+
+void sched_charge(sched_t *s, CopyClass cls, u64 ticks)
+{
+    mtx_lock(&s->mtx);
+    s->active[cls]--;
+    s->paid[cls] += ticks / s->weight[cls];
+    s->last_turn[cls] = armGetSystemTick();
+    cnd_broadcast(&s->can_run);
+    mtx_unlock(&s->mtx);
+}
+
+const char *copy_class_name(CopyClass cls)
+{
+    return cls < CopyClass_Count ? class_names[cls] : "unknown";
+}
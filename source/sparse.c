@@ -0,0 +1,84 @@
+#include <string.h>
+#include <arm_neon.h>
+#include <switch.h>
+
+#include "sparse.h"
+
+
+bool sparse_block_valid(size_t block)
+{
+    return block >= SPARSE_MIN_BLOCK && block <= SPARSE_MAX_BLOCK && !(block & (block - 1));
+}
+
+bool sparse_is_zero(const void *data, size_t size)
+{
+    const u8 *p = (const u8 *)data;
+
+    //  Or everything together, only looking at the result every 256 bytes so the loads aren't held up by it.
+    while (size >= 256)
+    {
+        uint8x16_t acc = vld1q_u8(p);
+        for (size_t i = 16; i < 256; i += 64)
+        {
+            acc = vorrq_u8(acc, vld1q_u8(p + i));
+            acc = vorrq_u8(acc, vld1q_u8(p + i + 16));
+            acc = vorrq_u8(acc, vld1q_u8(p + i + 32));
+            acc = vorrq_u8(acc, vld1q_u8(p + i + 48));
+        }
+        if (vmaxvq_u8(acc)) return false;
+        p += 256;
+        size -= 256;
+    }
+
+    for (; size >= 16; p += 16, size -= 16)
+    {
+        if (vmaxvq_u8(vld1q_u8(p))) return false;
+    }
+
+    while (size--)
+    {
+        if (*p++) return false;
+    }
+
+    return true;
+}
+
+//  The size of the block at offset, the last one can be short.
+static size_t block_at(size_t offset, size_t size, size_t block)
+{
+    return size - offset < block ? size - offset : block;
+}
+
+size_t sparse_write(file_t *f, const void *data, size_t size, size_t block, size_t *skipped)
+{
+    const u8 *p = (const u8 *)data;
+    size_t done = 0;
+    size_t zeros = 0;
+
+    while (done < size)
+    {
+        //  The run of blocks from here that are all zero, or all not.
+        bool zero = sparse_is_zero(p + done, block_at(done, size, block));
+        size_t run = block_at(done, size, block);
+        while (done + run < size)
+        {
+            size_t len = block_at(done + run, size, block);
+            if (sparse_is_zero(p + done + run, len) != zero) break;
+            run += len;
+        }
+
+        if (zero)
+        {
+            if (!file_seek(f, file_tell(f) + run)) break;
+            zeros += run;
+        }
+        else if (file_write(f, p + done, run) != run)
+        {
+            break;
+        }
+        done += run;
+    }
+
+    if (skipped) *skipped = zeros;
+    return done;
+}
@@ -0,0 +1,81 @@
+#include <string.h>
+#include <switch.h>
+
+#include "stats.h"
+#include "console.h"
+
+
+static const char *timer_names[StatTimer_Count] = { "io", "wait", "lock" };
+
+
+static double ticks_to_sec(u64 ticks)
+{
+    return (double)armTicksToNs(ticks) / 1e9;
+}
+
+static double mb_per_sec(u64 bytes, u64 ticks)
+{
+    double sec = ticks_to_sec(ticks);
+    return sec > 0.0 ? (double)bytes / (1024.0 * 1024.0) / sec : 0.0;
+}
+
+void stats_add(stat_timer_t *timer, u64 ticks)
+{
+    timer->count++;
+    timer->ticks += ticks;
+    if (ticks > timer->max_ticks) timer->max_ticks = ticks;
+
+    u64 us = armTicksToNs(ticks) / 1000;
+    size_t bucket = us ? 64 - __builtin_clzll(us) : 0;
+    if (bucket >= STATS_BUCKETS) bucket = STATS_BUCKETS - 1;
+    timer->buckets[bucket]++;
+}
+
+void stats_merge(stage_stats_t *dst, const stage_stats_t *src)
+{
+    for (size_t i = 0; i < StatTimer_Count; i++)
+    {
+        stat_timer_t *d = &dst->timers[i];
+        const stat_timer_t *s = &src->timers[i];
+
+        d->count += s->count;
+        d->ticks += s->ticks;
+        if (s->max_ticks > d->max_ticks) d->max_ticks = s->max_ticks;
+        for (size_t b = 0; b < STATS_BUCKETS; b++)
+        {
+            d->buckets[b] += s->buckets[b];
+        }
+    }
+    dst->bytes += src->bytes;
+    dst->skipped += src->skipped;
+}
+
+void stats_print(const char *name, const stage_stats_t *stats, u64 elapsed_ticks)
+{
+    const stat_timer_t *io = &stats->timers[StatTimer_Io];
+
+    //  Wall speed is what the user sees, io speed is what the storage managed whilst busy.
+    print_console("%s: %lu MiB, %.2f MB/s wall, %.2f MB/s io\n",
+        name, stats->bytes >> 20, mb_per_sec(stats->bytes, elapsed_ticks), mb_per_sec(stats->bytes, io->ticks));
+    if (stats->skipped) print_console("  %lu MiB skipped, zeros or already stored\n", stats->skipped >> 20);
+
+    for (size_t i = 0; i < StatTimer_Count; i++)
+    {
+        const stat_timer_t *t = &stats->timers[i];
+        print_console("  %-4s %8.3fs over %6lu, max %8.3fms\n",
+            timer_names[i], ticks_to_sec(t->ticks), t->count, (double)armTicksToNs(t->max_ticks) / 1e6);
+    }
+
+    //  Per chunk io latency, skipping empty buckets.
+    print_console("  io latency:");
+    for (size_t b = 0; b < STATS_BUCKETS; b++)
+    {
+        if (!io->buckets[b]) continue;
+
+        u64 upper_us = 1ULL << b;
+        if (b == STATS_BUCKETS - 1) print_console(" >=%lums:%lu", (upper_us >> 1) / 1000, io->buckets[b]);
+        else if (upper_us >= 1000) print_console(" <%lums:%lu", upper_us / 1000, io->buckets[b]);
+        else print_console(" <%luus:%lu", upper_us, io->buckets[b]);
+    }
+    print_console("\n");
+}
@@ -0,0 +1,33 @@
+#include <switch.h>
+
+#include "sync.h"
+
+
+void sync_spin_init(sync_spin_t *spin, bool enabled)
+{
+    spin->ticks = enabled ? SYNC_SPIN_DEFAULT_TICKS : 0;
+    spin->spun = 0;
+    spin->missed = 0;
+}
+
+bool sync_spin_until(sync_spin_t *spin, const atomic_size_t *counter, size_t need, const atomic_bool *cancelled)
+{
+    if (!spin->ticks) return false;
+
+    u64 start = armGetSystemTick();
+    do
+    {
+        if (atomic_load_explicit(counter, memory_order_acquire) >= need || atomic_load_explicit(cancelled, memory_order_relaxed))
+        {
+            spin->spun++;
+            spin->ticks = spin->ticks * 2 < SYNC_SPIN_MAX_TICKS ? spin->ticks * 2 : SYNC_SPIN_MAX_TICKS;
+            return true;
+        }
+        //  Just a hint that this is a spin loop.
+        __asm__ __volatile__("yield");
+    } while (armGetSystemTick() - start < spin->ticks);
+
+    spin->missed++;
+    spin->ticks = spin->ticks / 2 > SYNC_SPIN_MIN_TICKS ? spin->ticks / 2 : SYNC_SPIN_MIN_TICKS;
+    return false;
+}
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "tcp.h"
+
+
+bool tcp_is_path(const char *path)
+{
+    return path && !strncmp(path, TCP_PREFIX, strlen(TCP_PREFIX));
+}
+
+//  Starts listening for one connection on port, it is accepted by tcp_connected.
+static int tcp_listen(const char *port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) return -1;
+
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(atoi(port));
+
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0)
+    {
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+static int tcp_connect(const char *host, const char *port)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *res;
+    if (getaddrinfo(host, port, &hints, &res) != 0) return -1;
+
+    int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sock >= 0 && connect(sock, res->ai_addr, res->ai_addrlen) != 0)
+    {
+        close(sock);
+        sock = -1;
+    }
+
+    freeaddrinfo(res);
+    return sock;
+}
+
+//  Waits until sock has events, or something went wrong with it, which the recv / send after will find.
+//  Returns false if cancelled first, or the poll itself failed.
+static bool tcp_wait(const tcp_t *t, int sock, short events)
+{
+    for (;;)
+    {
+        if (t->cancelled && atomic_load(t->cancelled)) return false;
+
+        struct pollfd fd = { .fd = sock, .events = events };
+        int ready = poll(&fd, 1, TCP_POLL_MS);
+        if (ready > 0) return true;
+        if (ready < 0 && errno != EINTR) return false;
+    }
+}
+
+//  Accepts the connection to a listener, if it hasn't been already. Returns false if there isn't one.
+static bool tcp_connected(tcp_t *t)
+{
+    if (t->sock >= 0) return true;
+    if (t->listener < 0) return false;
+
+    if (tcp_wait(t, t->listener, POLLIN)) t->sock = accept(t->listener, NULL, NULL);
+    close(t->listener);
+    t->listener = -1;
+    return t->sock >= 0;
+}
+
+bool tcp_open(tcp_t *t, const char *path)
+{
+    t->sock = -1;
+    t->listener = -1;
+    t->cancelled = NULL;
+    if (!tcp_is_path(path)) return false;
+
+    char host[256];
+    snprintf(host, sizeof(host), "%s", path + strlen(TCP_PREFIX));
+
+    char *port = strrchr(host, ':');
+    if (!port) return false;
+    *port++ = '\0';
+
+    if (host[0]) t->sock = tcp_connect(host, port);
+    else t->listener = tcp_listen(port);
+    return t->sock >= 0 || t->listener >= 0;
+}
+
+size_t tcp_read(tcp_t *t, void *buf, size_t size, bool *failed)
+{
+    if (!tcp_connected(t))
+    {
+        *failed = true;
+        return 0;
+    }
+
+    size_t done = 0;
+    while (done < size)
+    {
+        if (!tcp_wait(t, t->sock, POLLIN))
+        {
+            *failed = true;
+            break;
+        }
+
+        ssize_t got = recv(t->sock, (char *)buf + done, size - done, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) *failed = true;
+        if (got <= 0) break;
+        done += got;
+    }
+    return done;
+}
+
+size_t tcp_write(tcp_t *t, const void *buf, size_t size)
+{
+    if (!tcp_connected(t)) return 0;
+
+    size_t done = 0;
+    while (done < size)
+    {
+        if (!tcp_wait(t, t->sock, POLLOUT)) break;
+
+        ssize_t sent = send(t->sock, (const char *)buf + done, size - done, 0);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) break;
+        done += sent;
+    }
+    return done;
+}
+
+void tcp_close(tcp_t *t)
+{
+    if (t->sock >= 0) close(t->sock);
+    if (t->listener >= 0) close(t->listener);
+    t->sock = -1;
+    t->listener = -1;
+}
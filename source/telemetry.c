@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <string.h>
+#include <switch.h>
+
+#include "telemetry.h"
+
+
+static double ticks_to_sec(u64 ticks)
+{
+    return (double)armTicksToNs(ticks) / 1e9;
+}
+
+//  The i'th oldest sample still kept, call with the lock held.
+static const telemetry_sample_t *sample_at(const telemetry_t *tel, size_t i)
+{
+    size_t kept = tel->count < TELEMETRY_MAX_SAMPLES ? tel->count : TELEMETRY_MAX_SAMPLES;
+    return &tel->samples[(tel->count - kept + i) % TELEMETRY_MAX_SAMPLES];
+}
+
+void telemetry_init(telemetry_t *tel, u64 start_tick)
+{
+    memset(tel, 0, sizeof(telemetry_t));
+    tel->start_tick = start_tick;
+    tel->last_tick = start_tick;
+    mutexInit(&tel->mtx);
+}
+
+bool telemetry_update(telemetry_t *tel, const telemetry_counters_t *now, bool force)
+{
+    u64 tick = armGetSystemTick();
+    u64 ticks = tick - tel->last_tick;
+    if (ticks < armNsToTicks(TELEMETRY_INTERVAL_MS * 1000000ULL) && !(force && ticks)) return false;
+
+    telemetry_sample_t sample =
+    {
+        .tick = tick - tel->start_tick,
+        .ticks = ticks,
+        .bytes_read = now->bytes_read - tel->last.bytes_read,
+        .bytes_written = now->bytes_written - tel->last.bytes_written,
+        .stall_ticks = now->stall_ticks - tel->last.stall_ticks,
+        .queue_depth = now->queue_depth,
+    };
+
+    mutexLock(&tel->mtx);
+    tel->samples[tel->count % TELEMETRY_MAX_SAMPLES] = sample;
+    tel->count++;
+    mutexUnlock(&tel->mtx);
+
+    tel->last_tick = tick;
+    tel->last = *now;
+    return true;
+}
+
+size_t telemetry_count(telemetry_t *tel)
+{
+    mutexLock(&tel->mtx);
+    size_t count = tel->count;
+    mutexUnlock(&tel->mtx);
+    return count;
+}
+
+size_t telemetry_latest(telemetry_t *tel, telemetry_sample_t *out, size_t max)
+{
+    mutexLock(&tel->mtx);
+    size_t kept = tel->count < TELEMETRY_MAX_SAMPLES ? tel->count : TELEMETRY_MAX_SAMPLES;
+    size_t n = kept < max ? kept : max;
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i] = *sample_at(tel, kept - n + i);
+    }
+    mutexUnlock(&tel->mtx);
+    return n;
+}
+
+bool telemetry_export(telemetry_t *tel, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) return false;
+
+    //  Raw counts as well as rates, so nothing is lost to rounding.
+    mutexLock(&tel->mtx);
+    size_t kept = tel->count < TELEMETRY_MAX_SAMPLES ? tel->count : TELEMETRY_MAX_SAMPLES;
+    bool ok = true;
+    for (size_t i = 0; i < kept && ok; i++)
+    {
+        const telemetry_sample_t *s = sample_at(tel, i);
+        ok = fprintf(fp, "{\"t\":%.3f,\"dt\":%.3f,\"read\":%lu,\"written\":%lu,"
+            "\"read_mb_s\":%.2f,\"write_mb_s\":%.2f,\"depth\":%lu,\"stall_ms\":%.3f}\n",
+            ticks_to_sec(s->tick), ticks_to_sec(s->ticks), s->bytes_read, s->bytes_written,
+            telemetry_rate(s->bytes_read, s->ticks), telemetry_rate(s->bytes_written, s->ticks),
+            s->queue_depth, (double)armTicksToNs(s->stall_ticks) / 1e6) > 0;
+    }
+    mutexUnlock(&tel->mtx);
+
+    ok &= fclose(fp) == 0;
+    return ok;
+}
+
+double telemetry_rate(u64 bytes, u64 ticks)
+{
+    double sec = ticks_to_sec(ticks);
+    return sec > 0.0 ? (double)bytes / (1024.0 * 1024.0) / sec : 0.0;
+}
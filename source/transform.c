@@ -0,0 +1,136 @@
+#include <string.h>
+#include <switch.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "transform.h"
+
+//  A zstd skippable frame, magic then the size of its payload, which is the frame size, content size and chunk size.
+#define SKIPPABLE_MAGIC 0x184D2A5E
+#define SKIPPABLE_PAYLOAD (TRANSFORM_HEADER_SIZE - 8)
+
+
+static void write_le32(u8 *out, u32 v)
+{
+    out[0] = v;
+    out[1] = v >> 8;
+    out[2] = v >> 16;
+    out[3] = v >> 24;
+}
+
+static u32 read_le32(const u8 *in)
+{
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((u32)in[3] << 24);
+}
+
+bool transform_available(TransformType type)
+{
+#ifdef HAVE_ZSTD
+    return true;
+#else
+    return type == TransformType_None;
+#endif
+}
+
+bool transform_init(transform_t *t, TransformType type, int level, size_t chunk_size)
+{
+    t->type = type;
+    t->ctx = NULL;
+    t->chunk_size = chunk_size;
+
+#ifdef HAVE_ZSTD
+    if (type == TransformType_Compress)
+    {
+        ZSTD_CCtx *cctx = ZSTD_createCCtx();
+        if (!cctx) return false;
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+        t->ctx = cctx;
+    }
+    else if (type == TransformType_Decompress)
+    {
+        t->ctx = ZSTD_createDCtx();
+        if (!t->ctx) return false;
+    }
+    return true;
+#else
+    (void)level;
+    return type == TransformType_None;
+#endif
+}
+
+void transform_exit(transform_t *t)
+{
+#ifdef HAVE_ZSTD
+    if (t->type == TransformType_Compress) ZSTD_freeCCtx(t->ctx);
+    else if (t->type == TransformType_Decompress) ZSTD_freeDCtx(t->ctx);
+#endif
+    t->ctx = NULL;
+}
+
+size_t transform_bound(TransformType type, size_t in_size)
+{
+#ifdef HAVE_ZSTD
+    //  Data that doesn't compress comes out a little bigger, and decompressing reads it back in.
+    if (type != TransformType_None) return TRANSFORM_HEADER_SIZE + ZSTD_compressBound(in_size);
+#endif
+    return in_size;
+}
+
+bool transform_run(transform_t *t, const void *in, size_t in_size, void *out, size_t out_cap, size_t *out_size)
+{
+#ifdef HAVE_ZSTD
+    if (t->type == TransformType_Compress)
+    {
+        if (out_cap < TRANSFORM_HEADER_SIZE) return false;
+
+        u8 *header = out;
+        size_t size = ZSTD_compress2(t->ctx, header + TRANSFORM_HEADER_SIZE, out_cap - TRANSFORM_HEADER_SIZE, in, in_size);
+        if (ZSTD_isError(size) || size > UINT32_MAX) return false;
+
+        write_le32(header, SKIPPABLE_MAGIC);
+        write_le32(header + 4, SKIPPABLE_PAYLOAD);
+        write_le32(header + 8, size);
+        write_le32(header + 12, in_size);
+        write_le32(header + 16, t->chunk_size);
+        *out_size = TRANSFORM_HEADER_SIZE + size;
+        return true;
+    }
+    else if (t->type == TransformType_Decompress)
+    {
+        //  The header was checked by the reader, this is for frames that weren't written by us.
+        unsigned long long content = ZSTD_getFrameContentSize(in, in_size);
+        if (content == ZSTD_CONTENTSIZE_ERROR || (content != ZSTD_CONTENTSIZE_UNKNOWN && content > out_cap)) return false;
+
+        size_t size = ZSTD_decompressDCtx(t->ctx, out, out_cap, in, in_size);
+        if (ZSTD_isError(size)) return false;
+        *out_size = size;
+        return true;
+    }
+#endif
+
+    //  There are only transform threads when there is something to transform.
+    return false;
+}
+
+bool transform_parse_header(const void *header, transform_header_t *out)
+{
+    const u8 *in = header;
+    if (read_le32(in) != SKIPPABLE_MAGIC || read_le32(in + 4) != SKIPPABLE_PAYLOAD) return false;
+    out->frame_size = read_le32(in + 8);
+    out->content_size = read_le32(in + 12);
+    out->chunk_size = read_le32(in + 16);
+    return true;
+}
+
+const char *transform_name(TransformType type)
+{
+    switch (type)
+    {
+        case TransformType_None: return "none";
+        case TransformType_Compress: return "zstd compress";
+        case TransformType_Decompress: return "zstd decompress";
+    }
+    return "unknown";
+}
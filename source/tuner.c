@@ -0,0 +1,87 @@
+#include <string.h>
+
+#include "tuner.h"
+#include "trace.h"
+
+
+static double window_mbs(u64 bytes, u64 ticks)
+{
+    double sec = (double)armTicksToNs(ticks) / 1e9;
+    return sec > 0.0 ? (double)bytes / (1024.0 * 1024.0) / sec : 0.0;
+}
+
+static void reset_window(chunk_tuner_t *tuner)
+{
+    tuner->read_bytes = tuner->read_ticks = tuner->read_chunks = 0;
+    tuner->write_bytes = tuner->write_ticks = tuner->write_chunks = 0;
+}
+
+static bool window_done(const chunk_tuner_t *tuner)
+{
+    return tuner->read_chunks >= TUNER_WINDOW_CHUNKS && tuner->read_bytes >= TUNER_WINDOW_BYTES &&
+        tuner->write_chunks >= TUNER_WINDOW_CHUNKS && tuner->write_bytes >= TUNER_WINDOW_BYTES;
+}
+
+//  Doubles or halves the size, turning around when it hits either end.
+static void step(chunk_tuner_t *tuner)
+{
+    size_t size = tuner->direction > 0 ? tuner->size * 2 : tuner->size / 2;
+    if (size > tuner->max_size) size = tuner->max_size;
+    if (size < tuner->min_size) size = tuner->min_size;
+
+    if (size == tuner->size) tuner->direction = -tuner->direction;
+    tuner->size = size;
+}
+
+void tuner_init(chunk_tuner_t *tuner, size_t max_size)
+{
+    memset(tuner, 0, sizeof(chunk_tuner_t));
+    tuner->max_size = max_size;
+    tuner->min_size = max_size < TUNER_MIN_SIZE ? max_size : TUNER_MIN_SIZE;
+    tuner->size = max_size < TUNER_PROBE_SIZE ? max_size : TUNER_PROBE_SIZE;
+    tuner->direction = 1;
+    tuner->last_mbs = -1.0;
+}
+
+void tuner_add_read(chunk_tuner_t *tuner, size_t chunk_size, size_t bytes, u64 ticks)
+{
+    if (chunk_size != tuner->size) return;
+    tuner->read_bytes += bytes;
+    tuner->read_ticks += ticks;
+    tuner->read_chunks++;
+}
+
+void tuner_add_write(chunk_tuner_t *tuner, size_t chunk_size, size_t bytes, u64 ticks)
+{
+    if (chunk_size != tuner->size) return;
+    tuner->write_bytes += bytes;
+    tuner->write_ticks += ticks;
+    tuner->write_chunks++;
+}
+
+size_t tuner_next(chunk_tuner_t *tuner)
+{
+    if (!window_done(tuner)) return tuner->size;
+
+    double read_mbs = window_mbs(tuner->read_bytes, tuner->read_ticks);
+    double write_mbs = window_mbs(tuner->write_bytes, tuner->write_ticks);
+    double mbs = read_mbs < write_mbs ? read_mbs : write_mbs;
+
+    //  5% either way is noise, stay where we are but keep watching.
+    bool first = tuner->last_mbs < 0.0;
+    if (first || mbs > tuner->last_mbs * 1.05)
+    {
+        step(tuner);
+    }
+    else if (mbs < tuner->last_mbs * 0.95)
+    {
+        tuner->direction = -tuner->direction;
+        step(tuner);
+    }
+
+    TRACE(TRACE_INFO, "tuner: %.2f MB/s (read %.2f, write %.2f), now %lu KiB\n", mbs, read_mbs, write_mbs, tuner->size >> 10);
+
+    tuner->last_mbs = mbs;
+    reset_window(tuner);
+    return tuner->size;
+}